@@ -14,7 +14,6 @@
 #include <Arduino.h>
 #include <CircuitOS.h>
 #include <ByteBoi.h>
-#include <lgfx/v1/misc/colortype.hpp>
 
 #define PLUS_BRIGHTNESS 0 // this can be changed (max: 8)
 
@@ -29,23 +28,63 @@
 #define SFG_RAYCASTING_MAX_HITS 15
 #define SFG_DIMINISH_SPRITES 1
 #define SFG_DITHERED_SHADOW 1
+#define SFG_RENDERING_THREADS 2 // one part of the view is rendered on each core
+#define SFG_VIEW_REUSE 1 // don't redraw the 3D view while nothing in it changes
+#define SFG_QUALITY_GOVERNOR 1 // lower quality in heavy scenes to keep the FPS
+#define RCL_RECIPROCAL_DIVISION 1 // ESP32 divides slowly but multiplies fast
 
 #define SFG_CAN_EXIT 1/* If the game is compiled into loeader, this can be set
                           to 1 which will show the "exit" option in the menu. */
+
+void frameDrawn();
+#define SFG_FRAME_DRAWN_COMMAND frameDrawn();
+
 #include "src/game.h"
 #include "src/Anarch.h"
+
+/* RAM budget: the game's state is static (about 71 KB with the settings above,
+   mostly the per-square grids and the caches turned on in settings.h) and
+   Anarch allocates two indexed frame buffers and a saved view (3 * 19200 B).
+   The ESP32 has about 300 KB of DRAM, the rest is needed for the display
+   sprite (160 * 128 * 2 B), the tasks' stacks and the firmware, so keep this
+   part under 128 KB when turning on more caches (e.g. SFG_DEPTH_BUFFER).
+   SFG_MAX_PROJECTILES is 24 instead of the original 12: a full table drops
+   monster shots and explosions, and fights with several shooting monsters
+   reach 12. Each projectile takes 14 B plus a 16 B view sprite, so the extra
+   12 cost about 360 B. */
+static_assert(sizeof(SFG_game) + sizeof(SFG_currentLevel) +
+	3 * SFG_SCREEN_RESOLUTION_X * SFG_SCREEN_RESOLUTION_Y <= 128 * 1024,
+	"game state and frame buffers don't fit the RAM budget");
 #include <SleepService.h>
 Display* display;
 uint8_t buttons[7];
-uint16_t paletteRAM[256];
 Anarch* game;
+uint8_t* frameBuffer; // indexed frame buffer owned by game, converted to RGB565 once per frame
+
+void frameDrawn()
+{
+	// push the frame on the other core while the next one is drawn
+	frameBuffer = game->submitFrame();
+}
+
+void SFG_renderViewParallel()
+{
+	game->renderParallel(SFG_renderViewPart);
+}
 
-void SFG_setPixel(uint16_t x, uint16_t y, uint8_t colorIndex)
+void SFG_saveView()
 {
-	Color c = paletteRAM[colorIndex];
-	lgfx::rgb565_t c2(c);
-	c2.set(c2.R8(),c2.G8(),c2.B8());
-	game->drawPixel(x, y,c2.operator unsigned short());
+	game->saveView();
+}
+
+void SFG_restoreView()
+{
+	game->restoreView();
+}
+
+static inline void SFG_setPixel(uint16_t x, uint16_t y, uint8_t colorIndex)
+{
+	frameBuffer[y * SFG_SCREEN_RESOLUTION_X + x] = colorIndex;
 }
 
 uint32_t SFG_getTimeMs()
@@ -155,8 +194,13 @@ void setup()
 	for (uint8_t i = 0; i < 7; ++i)
 		buttons[i] = 0;
 
+	game = new Anarch(display, SFG_SCREEN_RESOLUTION_X, SFG_SCREEN_RESOLUTION_Y);
+	frameBuffer = game->getFrameBuffer();
+
 	// move palette to RAM plus increase brightness of the colors:
 
+	uint16_t paletteRAM[256];
+
 	for (int i = 0; i < 256; ++i)
 	{
 		int helper = i % 8;
@@ -164,6 +208,8 @@ void setup()
 		paletteRAM[i] = pgm_read_word(paletteRGB565 + i + helper);
 	}
 
+	game->setPalette(paletteRAM);
+
 	// register button callbacks:
 
 #define cb(b) \
@@ -180,7 +226,6 @@ void setup()
 
 #undef cb
 
-	game = new Anarch(display);
 	game->unpack();
 	ByteBoi.splash();
 	game->start();
@@ -3,12 +3,52 @@
 extern uint8_t SFG_mainLoopBody();
 
 
-Anarch::Anarch(Display* display) : Context(*display), display(display), baseSprite(screen.getSprite()){
+Anarch::Anarch(Display* display, uint16_t width, uint16_t height) : Context(*display), display(display), baseSprite(screen.getSprite()),
+		width(width), height(height){
 
+	for(int i = 0; i < 2; i++){
+		frameBuffers[i] = (uint8_t*) malloc(width * height);
+		memset(frameBuffers[i], 0, width * height);
+	}
+
+	drawBuffer = frameBuffers[0];
+
+	viewBuffer = (uint8_t*) malloc(width * height);
+	memset(viewBuffer, 0, width * height);
+	memset(palette, 0, sizeof(palette));
+
+	frameReady = xSemaphoreCreateBinary();
+	pushDone = xSemaphoreCreateBinary();
+	xSemaphoreGive(pushDone);
+
+	// the loop task is the display's owner, it only lets go of it while the game draws into its own buffers
+	displayLock = xSemaphoreCreateMutex();
+	xSemaphoreTake(displayLock, portMAX_DELAY);
+
+	renderStart = xSemaphoreCreateBinary();
+	renderDone = xSemaphoreCreateBinary();
 }
 
 Anarch::~Anarch(){
+	if(pushTask){
+		waitForPush();
+		vTaskDelete(pushTask);
+	}
+
+	if(renderTask){
+		vTaskDelete(renderTask);
+	}
 
+	vSemaphoreDelete(frameReady);
+	vSemaphoreDelete(pushDone);
+	xSemaphoreGive(displayLock);
+	vSemaphoreDelete(displayLock);
+	vSemaphoreDelete(renderStart);
+	vSemaphoreDelete(renderDone);
+
+	free(frameBuffers[0]);
+	free(frameBuffers[1]);
+	free(viewBuffer);
 }
 
 void Anarch::draw(){
@@ -17,20 +57,132 @@ void Anarch::draw(){
 
 void Anarch::start(){
 	baseSprite = display->getBaseSprite();
+
+	if(!pushTask){
+		// the Arduino loop runs on core 1, push frames from core 0
+		xTaskCreatePinnedToCore(pushTaskFunc, "AnarchPush", 4096, this, 1, &pushTask, 0);
+	}
+
+	if(!renderTask){
+		// higher priority than pushing, the game's task waits for the render
+		xTaskCreatePinnedToCore(renderTaskFunc, "AnarchRender", 8192, this, 2, &renderTask, 0);
+	}
+
 	LoopManager::addListener(this);
 }
 
 void Anarch::stop(){
+	handOverFrame();
+	xSemaphoreGive(displayLock);
+	waitForPush();
+	xSemaphoreTake(displayLock, portMAX_DELAY);
 	baseSprite = screen.getSprite();
 	LoopManager::removeListener(this);
 }
 
-void Anarch::drawPixel(uint16_t x, uint16_t y, uint16_t colorIndex){
-	baseSprite->drawPixel(x, y, colorIndex);
+uint8_t* Anarch::getFrameBuffer() const{
+	return drawBuffer;
+}
+
+uint8_t* Anarch::submitFrame(){
+	// a second frame in the same loop, the display lock is free at this point so the first one can go right away
+	handOverFrame();
+
+	xSemaphoreTake(pushDone, portMAX_DELAY);
+
+	pushBuffer = drawBuffer;
+	drawBuffer = (drawBuffer == frameBuffers[0]) ? frameBuffers[1] : frameBuffers[0];
+	framePending = true;
+
+	return drawBuffer;
+}
+
+void Anarch::handOverFrame(){
+	if(framePending){
+		framePending = false;
+		xSemaphoreGive(frameReady);
+	}
+}
+
+void Anarch::waitForPush(){
+	xSemaphoreTake(pushDone, portMAX_DELAY);
+	xSemaphoreGive(pushDone);
+}
+
+void Anarch::setPalette(const uint16_t* palette){
+	for(int i = 0; i < 256; i++){
+		this->palette[i] = __builtin_bswap16(palette[i]);
+	}
+}
+
+void Anarch::renderParallel(void (*renderPart)(uint8_t part)){
+	renderPartFunc = renderPart;
+	xSemaphoreGive(renderStart);
+
+	renderPart(0);
+
+	xSemaphoreTake(renderDone, portMAX_DELAY);
+}
+
+void Anarch::saveView(){
+	memcpy(viewBuffer, drawBuffer, width * height);
+}
+
+void Anarch::restoreView(){
+	memcpy(drawBuffer, viewBuffer, width * height);
+}
+
+void Anarch::renderTaskFunc(void* arg){
+	auto game = static_cast<Anarch*>(arg);
+
+	for(;;){
+		xSemaphoreTake(game->renderStart, portMAX_DELAY);
+
+		game->renderPartFunc(1);
+
+		xSemaphoreGive(game->renderDone);
+	}
+}
+
+void Anarch::pushTaskFunc(void* arg){
+	auto game = static_cast<Anarch*>(arg);
+
+	for(;;){
+		xSemaphoreTake(game->frameReady, portMAX_DELAY);
+		xSemaphoreTake(game->displayLock, portMAX_DELAY);
+
+		game->pushFrame(game->pushBuffer);
+		game->display->commit();
+
+		xSemaphoreGive(game->displayLock);
+		xSemaphoreGive(game->pushDone);
+	}
+}
+
+void Anarch::pushFrame(const uint8_t* frame){
+	uint16_t* out = static_cast<uint16_t*>(baseSprite->getBuffer());
+	const uint16_t stride = baseSprite->width();
+
+	for(uint16_t y = 0; y < height; y++){
+		for(uint16_t x = 0; x < width; x++){
+			out[x] = palette[frame[x]];
+		}
+
+		frame += width;
+		out += stride;
+	}
 }
 
 void Anarch::loop(uint micros){
+	// the lock must be taken by the task running the other loop listeners, or their drawing could overlap a push
+	configASSERT(xSemaphoreGetMutexHolder(displayLock) == xTaskGetCurrentTaskHandle());
+
+	// the other loop listeners are done with the display now, push the frame submitted in the last loop
+	handOverFrame();
+	xSemaphoreGive(displayLock);
+
+	// frames are submitted through submitFrame(), called by the game when a frame is drawn
 	SFG_mainLoopBody();
-	draw();
-	display->commit();
+
+	xSemaphoreTake(displayLock, portMAX_DELAY);
 }
@@ -7,10 +7,25 @@
 #include <Input/InputI2C.h>
 #include <Loop/LoopManager.h>
 #include <Support/Context.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 
+/**
+ * Frames are double buffered: the game draws into one indexed frame buffer while a task on the other core converts
+ * the previously finished one to RGB565 and pushes it to the display. Another task on that core can render a part of
+ * the 3D view in parallel with the game's task.
+ *
+ * The display sprite is guarded by a lock that the loop task holds everywhere except inside Anarch::loop(), so the push
+ * task only touches the display while the game is drawing into its own buffers. Other loop listeners (e.g. popups) can
+ * keep drawing to the display as usual, anything else has to draw from the loop task too.
+ */
 class Anarch : public Context, public LoopListener{
 public:
-	Anarch(Display* display);
+	/**
+	 * @param width, height Size of the game's screen in pixels, the indexed frame buffers are allocated to fit it.
+	 */
+	Anarch(Display* display, uint16_t width, uint16_t height);
 
 	~Anarch() override;
 
@@ -22,11 +37,81 @@ public:
 
 	void loop(uint micros) override;
 
-	void drawPixel(uint16_t x, uint16_t y, uint16_t colorIndex);
+	/**
+	 * Indexed frame buffer the game currently draws into, one palette index per pixel, row by row.
+	 */
+	uint8_t* getFrameBuffer() const;
+
+	/**
+	 * Hands the finished frame buffer over to the push task and returns the buffer to draw the next frame into. Blocks
+	 * until the frame before is done being pushed, so that the returned buffer is free. The frame is pushed once the
+	 * next loop() starts, after the other loop listeners have drawn to the display.
+	 */
+	uint8_t* submitFrame();
+
+	/**
+	 * Blocks until the last submitted frame has been pushed to the display.
+	 */
+	void waitForPush();
+
+	/**
+	 * Sets the RGB565 palette used to convert the frame buffer to display colors. The palette is copied.
+	 */
+	void setPalette(const uint16_t* palette);
+
+	/**
+	 * Calls renderPart(1) on the other core while renderPart(0) runs on the calling one. Returns once both are done.
+	 */
+	void renderParallel(void (*renderPart)(uint8_t part));
+
+	/**
+	 * Copies the frame buffer drawn so far to a separate view buffer.
+	 */
+	void saveView();
+
+	/**
+	 * Copies the last saved view buffer into the frame buffer being drawn.
+	 */
+	void restoreView();
 
 private:
 	Display* display;
 	Sprite *baseSprite;
+
+	const uint16_t width;
+	const uint16_t height;
+
+	uint8_t* frameBuffers[2];
+	uint8_t* drawBuffer;
+	uint8_t* viewBuffer; // the game's 3D view without HUD, reused while it doesn't change
+	uint8_t* volatile pushBuffer = nullptr;
+	bool framePending = false; // pushBuffer is submitted but not yet handed over to the push task
+
+	/** Palette with the bytes already swapped to the order the display sprite buffer expects. */
+	uint16_t palette[256];
+
+	TaskHandle_t pushTask = nullptr;
+	SemaphoreHandle_t frameReady; // given when a frame is submitted, taken by the push task
+	SemaphoreHandle_t pushDone; // given by the push task once the submitted frame is on the display
+	SemaphoreHandle_t displayLock; // held by the loop task outside of loop() and by the push task while pushing
+
+	TaskHandle_t renderTask = nullptr;
+	SemaphoreHandle_t renderStart;
+	SemaphoreHandle_t renderDone;
+	void (* volatile renderPartFunc)(uint8_t part) = nullptr;
+
+	static void pushTaskFunc(void* arg);
+
+	/**
+	 * Lets the push task have the frame submitted in the last loop.
+	 */
+	void handOverFrame();
+	static void renderTaskFunc(void* arg);
+
+	/**
+	 * Converts the indexed frame buffer to RGB565 and writes it to the display sprite buffer in a single pass.
+	 */
+	void pushFrame(const uint8_t* frame);
 };
 
 #endif //ANARCH_ANARCH_H
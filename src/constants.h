@@ -70,6 +70,19 @@
 */
 #define SFG_LEVEL_ELEMENT_ACTIVE_DISTANCE (12 * 1024)
 
+/**
+  How many doors per frame the locked card blinking steps through, counting
+  down once all doors have been stepped through (slower on levels with more
+  doors, as with the original round-robin door checks).
+*/
+#define SFG_CARD_BLINK_DOORS_PER_FRAME 8
+
+/**
+  Taxicab distance the player can move before all level elements are checked
+  for activation from the new position, see SFG_updateActivation.
+*/
+#define SFG_ACTIVATION_RESET_DISTANCE (2 * RCL_UNITS_PER_SQUARE)
+
 /**
   Rate at which AI will be updated, which also affects how fast enemies will
   appear.
@@ -161,12 +174,57 @@
 */
 #define SFG_PROJECTILE_SPREAD_ANGLE 100
 
+/**
+  Maximum number of monsters in a level, can't be more than 64 because sets of
+  monsters are kept as 64 bit masks (bit i = monster record i).
+*/
 #define SFG_MAX_MONSTERS 64
 
-#define SFG_MAX_PROJECTILES 12
+/**
+  Size of one area of the monster grid (see SFG_MONSTER_GRID) in squares, the
+  grid has SFG_MONSTER_GRID_SIZE x SFG_MONSTER_GRID_SIZE areas.
+*/
+#define SFG_MONSTER_GRID_CELL 8
+
+#define SFG_MONSTER_GRID_SIZE (SFG_MAP_SIZE / SFG_MONSTER_GRID_CELL)
+
+#define SFG_MAX_PROJECTILES 24
 
 #define SFG_MAX_DOORS 32
 
+#define SFG_NO_DOOR 255 ///< Door index of squares without door.
+
+#define SFG_MAX_MOVING_WALLS 255 ///< Max. number of elevator/squeezer squares.
+
+/**
+  Bit of a SFG_currentLevel.floorCeilingGrid value saying the square moves (is
+  a door, elevator or squeezer), the lower bits are then an index to
+  SFG_currentLevel.movingFloorCeilings (doors first, then moving walls).
+*/
+#define SFG_MOVING_SQUARE 0x8000
+
+/**
+  Number of shading levels in the shade table. A color has 8 values in the
+  palette, so shading by 8 or more always gives black.
+*/
+#define SFG_SHADE_LEVELS 9
+
+/**
+  Number of entries in the sprite visibility cache, has to be a power of two.
+*/
+#define SFG_VISIBILITY_CACHE_SIZE 64
+
+#define SFG_NO_SQUARE 0xffff ///< Square index meaning no square (end of list).
+
+#define SFG_SIGHT_BLOCKED 255 ///< Sight grid value of unreachable squares.
+
+#define SFG_FLOW_UNREACHABLE 255 ///< Flow field value of unreachable squares.
+
+/**
+  Number of rendering quality levels SFG_QUALITY_GOVERNOR switches between.
+*/
+#define SFG_QUALITY_LEVELS 4
+
 #define SFG_AMMO_BULLETS 0
 #define SFG_AMMO_ROCKETS 1
 #define SFG_AMMO_PLASMA 2
@@ -354,6 +412,27 @@
 
 #define SFG_Z_BUFFER_SIZE SFG_GAME_RESOLUTION_X
 
+/**
+  Bytes of the sprite cover mask (SFG_game.spriteCover) for each screen column,
+  one bit per row.
+*/
+#define SFG_SPRITE_COVER_COLUMN_BYTES ((SFG_GAME_RESOLUTION_Y + 7) / 8)
+
+/**
+  Width of the depth buffer (see SFG_DEPTH_BUFFER), which has a byte for each
+  raycasting column. The quality governor only ever makes the subsample
+  bigger, so the number of columns never exceeds this.
+*/
+#define SFG_DEPTH_BUFFER_WIDTH \
+  (SFG_GAME_RESOLUTION_X / SFG_RAYCASTING_SUBSAMPLE)
+
+/**
+  Maximum number of sprites drawn in one frame (all monsters, items and
+  projectiles).
+*/
+#define SFG_MAX_VIEW_SPRITES \
+  (SFG_MAX_MONSTERS + SFG_MAX_ITEMS + SFG_MAX_PROJECTILES)
+
 /**
   Step in which walls get higher, in raycastlib units.
 */
@@ -82,6 +82,13 @@
                                    multiple simulation steps). */
 #endif
 
+#ifndef SFG_FRAME_DRAWN_COMMAND
+  #define SFG_FRAME_DRAWN_COMMAND {} /**< Will be called each time a whole
+                                   frame has been drawn with SFG_setPixel (good
+                                   for swapping frame buffers, the game always
+                                   redraws the whole screen). */
+#endif
+
 /** 
   Returns 1 (0) if given key is pressed (not pressed). At least the mandatory
   keys have to be implemented, the optional keys don't have to ever return 1.
@@ -183,6 +190,24 @@ void SFG_save(uint8_t data[SFG_SAVE_SIZE]);
 */
 uint8_t SFG_load(uint8_t data[SFG_SAVE_SIZE]);
 
+/**
+  Only needed if SFG_RENDERING_THREADS is greater than 1. This function has to
+  call SFG_renderViewPart(i) for each i from 0 to SFG_RENDERING_THREADS - 1 and
+  return only after all the calls have finished. The calls may (and should, for
+  performance) run in parallel, e.g. on different CPU cores. They only read the
+  game state and each one draws different screen columns with SFG_setPixel.
+*/
+void SFG_renderViewParallel();
+
+/**
+  Only needed if SFG_VIEW_REUSE is 1. SFG_saveView has to store a copy of the
+  whole screen drawn so far (it is called after the 3D view has been drawn, but
+  before the weapon and HUD) and SFG_restoreView has to draw the last stored
+  copy back to the screen, instead of the game drawing the same view again.
+*/
+void SFG_saveView();
+void SFG_restoreView();
+
 /* ========================================================================= */
 
 /**
@@ -198,8 +223,17 @@ uint8_t SFG_mainLoopBody();
 */
 void SFG_init();
 
+/**
+  Sets the frame rate which SFG_QUALITY_GOVERNOR tries to keep by adjusting the
+  rendering quality, by default it's SFG_FPS. Does nothing if the governor is
+  off.
+*/
+void SFG_setTargetFPS(uint8_t fps);
+
 #include "settings.h"
 
+#define SFG_UNUSED(what) (void)(what); ///< Silences unused warnings.
+
 #if SFG_AVR
   //#include <avr/pgmspace.h>
 
@@ -219,7 +253,29 @@ void SFG_init();
   #define RCL_COMPUTE_WALL_TEXCOORDS 0
 #endif
 
+#if SFG_BACKGROUND_BLUR != 0 || !SFG_DRAW_LEVEL_BACKGROUND
+  #undef SFG_CACHE_BACKGROUND
+  #define SFG_CACHE_BACKGROUND 0
+#endif
+
+#if SFG_QUALITY_GOVERNOR
+  // current values set by the governor
+  #define SFG_VIEW_SUBSAMPLE SFG_game.subsample
+  #define SFG_VIEW_TEXTURE_DISTANCE SFG_game.textureDistance
+#else
+  #define SFG_VIEW_SUBSAMPLE SFG_RAYCASTING_SUBSAMPLE
+  #define SFG_VIEW_TEXTURE_DISTANCE SFG_TEXTURE_DISTANCE
+#endif
+
+// floor and ceiling colors fully shaded per level, see SFG_currentLevel
+#define SFG_FLAT_SHADES (SFG_SHADE_TABLES && SFG_DITHERED_SHADOW &&\
+  SFG_ENABLE_FOG && !SFG_DIFFERENT_FLOOR_CEILING_COLORS)
+
 #define RCL_PIXEL_FUNCTION SFG_pixelFunc
+#if SFG_VIEW_SPANS
+  #define RCL_SPAN_FUNCTION SFG_spanFunc
+#endif
+#define RCL_FLOOR_CEIL_FUNCTION SFG_floorCeilingAt
 #define RCL_TEXTURE_VERTICAL_STRETCH 0
 
 #define RCL_CAMERA_COLL_HEIGHT_BELOW 800
@@ -308,6 +364,10 @@ typedef struct
 #define SFG_MONSTER_STATE_GOING_NW  12
 #define SFG_MONSTER_STATE_DEAD      13
 
+/**
+  Projectile to be added with SFG_createProjectile. The level keeps each of
+  these fields in a separate array (SFG_currentLevel.projectileTypes etc.).
+*/
 typedef struct
 {
   uint8_t  type;
@@ -320,6 +380,33 @@ typedef struct
   int16_t direction[3]; /**< Added to position each game step. */
 } SFG_ProjectileRecord;
 
+#if SFG_VISIBILITY_CACHE
+/**
+  Sprite visibility cache entry, holds all inputs of the line of sight check
+  apart from the map.
+*/
+typedef struct
+{
+  uint16_t viewer[2];       ///< camera position
+  RCL_Unit viewerHeight;    ///< camera height
+  uint16_t position[2];     ///< sprite position
+  RCL_Unit height;          ///< sprite height
+} SFG_VisibilityEntry;
+#endif
+
+/**
+  Sprite to be drawn in the current frame, in screen coordinates.
+*/
+typedef struct
+{
+  const uint8_t *image;
+  int16_t x;
+  int16_t y;
+  int16_t size;
+  uint8_t minusValue;
+  RCL_Unit depth;
+} SFG_ViewSprite;
+
 #define SFG_GAME_STATE_INIT 0 ///< first state, waiting for key releases
 #define SFG_GAME_STATE_PLAYING 1
 #define SFG_GAME_STATE_WIN 2
@@ -341,6 +428,21 @@ typedef struct
 
 #define SFG_MENU_ITEM_NONE 255
 
+#define SFG_VISIBILITY_ENTRY_VALID 0x01
+#define SFG_VISIBILITY_ENTRY_VISIBLE 0x02
+#define SFG_VISIBILITY_ENTRY_DYNAMIC 0x04 ///< ray area contains moving squares
+
+#define SFG_ITEM_SPRITE_COUNT (sizeof(SFG_itemSprites) / SFG_TEXTURE_STORE_SIZE)
+
+#define SFG_EFFECT_SPRITE_COUNT \
+  (sizeof(SFG_effectSprites) / SFG_TEXTURE_STORE_SIZE)
+
+#define SFG_MONSTER_SPRITE_COUNT \
+  (sizeof(SFG_monsterSprites) / SFG_TEXTURE_STORE_SIZE)
+
+#define SFG_SPRITE_COUNT (SFG_ITEM_SPRITE_COUNT + SFG_EFFECT_SPRITE_COUNT + \
+  SFG_MONSTER_SPRITE_COUNT)
+
 /*
   GLOBAL VARIABLES
 ===============================================================================
@@ -364,15 +466,72 @@ struct
   uint8_t keyStates[SFG_KEY_COUNT]; /**< Pressed states of keys, each value
                                     stores the number of frames for which the
                                     key has been held. */
-  uint8_t zBuffer[SFG_Z_BUFFER_SIZE];
+  uint8_t spriteCover[SFG_Z_BUFFER_SIZE * SFG_SPRITE_COVER_COLUMN_BYTES]; /**<
+                                    Bit mask of the screen pixels drawn by the
+                                    sprites so far (front to back) so that
+                                    farther sprites skip them, column by
+                                    column (SFG_SPRITE_COVER_COLUMN_BYTES each),
+                                    bit y % 8 of byte y / 8 for row y. */
+#if SFG_DEPTH_BUFFER
+  uint8_t depthBuffer[SFG_DEPTH_BUFFER_WIDTH * SFG_GAME_RESOLUTION_Y]; /**< Depth
+                                    (as SFG_RCLUnitToZBuffer, 255 for
+                                    background) of each view pixel, indexed by
+                                    raycasting column (see
+                                    SFG_RAYCASTING_SUBSAMPLE) and row. */
+#endif
+  SFG_ViewSprite viewSprites[SFG_MAX_VIEW_SPRITES]; /**< Sprites of the current
+                                    frame sorted by depth, nearest first. */
+  uint16_t viewSpriteCount;
   uint8_t textureAverageColors[SFG_WALL_TEXTURE_COUNT]; /**< Contains average
                                     color for each wall texture. */
   int8_t backgroundScaleMap[SFG_GAME_RESOLUTION_Y];
+#if SFG_CACHE_BACKGROUND
+  uint8_t backgroundColumnMap[SFG_GAME_RESOLUTION_X]; /**< For each view
+                                    column the background texture column seen
+                                    through it in the current frame. */
+#endif
+#if SFG_SHADE_TABLES
+  uint8_t shadeTable[SFG_SHADE_LEVELS][256]; /**< Colors diminished by each
+                                    shading level, as palette_minusValue. */
+  #if SFG_DITHERED_SHADOW
+  uint8_t fogShadowRamp[8][256]; /**< Dithered fog shadow (clamped to the
+                                    last shading level) for each dithering
+                                    pattern position (y % 2 * 4 + x % 4) and
+                                    fog value ((depth * 8) / fog step). */
+  #endif
+#endif
   uint16_t backgroundScroll;
+#if SFG_VIEW_REUSE
+  uint32_t worldEpoch;  /**< Increased by each change of the world that shows
+                             in the view but isn't part of SFG_viewKey, e.g.
+                             loading a level. */
+  uint32_t viewKey;     ///< SFG_viewKey of the last drawn view.
+  uint8_t viewSaved;    ///< Whether the view with viewKey has been saved.
+  uint8_t viewAnimated; ///< Whether the last drawn view showed a monster.
+#endif
+#if SFG_QUALITY_GOVERNOR
+  uint8_t qualityLevel;      ///< Current quality level, 0 is the best.
+  uint8_t qualityHold;       ///< Frames until the level may change again.
+  uint8_t subsample;         ///< Current SFG_RAYCASTING_SUBSAMPLE.
+  RCL_Unit textureDistance;  ///< Current SFG_TEXTURE_DISTANCE.
+  uint16_t targetFrameTime;  ///< Target frame time in 1/16 ms.
+  uint16_t frameTimeAverage; ///< Moving average of frame time in 1/16 ms.
+#endif
   uint8_t spriteSamplingPoints[SFG_MAX_SPRITE_SIZE]; /**< Helper for
                                                      precomputing sprite
                                                      sampling positions for
                                                      drawing. */
+#if SFG_SIGHT_GRID || SFG_MONSTER_FLOW_FIELD
+  uint16_t squareLinks[SFG_MAP_SIZE * SFG_MAP_SIZE]; /**< Helper for building
+                                    lists (queues) of map squares, for each
+                                    square the index of the next square. */
+#endif
+#if SFG_SPRITE_COLUMN_MASKS
+  uint32_t spriteColumnMasks[SFG_SPRITE_COUNT][SFG_TEXTURE_SIZE]; /**< For
+                                    each sprite (items, effects, monsters) and
+                                    its column a bit mask of opaque texels,
+                                    bit i meaning row i. */
+#endif
   uint32_t frameTime;      ///< time (in ms) of the current frame start
   uint32_t frame;          ///< frame number
   uint8_t selectedMenuItem;
@@ -454,20 +613,47 @@ struct
   uint32_t completionTime10sOfS; ///< completion time in 10ths of second
   uint8_t floorColor;
   uint8_t ceilingColor;
+#if SFG_FLAT_SHADES
+  /** Floor (0) and ceiling (1) color already shaded for each dithering
+    position and fog value, indexed the same as SFG_game.fogShadowRamp, so
+    that a flat pixel only takes one lookup. */
+  uint8_t flatShades[2][8][256];
+#endif
 
   SFG_DoorRecord doorRecords[SFG_MAX_DOORS];
   uint8_t doorRecordCount;
-  uint8_t checkedDoorIndex; ///< Says which door are currently being checked.
 
   SFG_ItemRecord itemRecords[SFG_MAX_ITEMS]; ///< Holds level items.
   uint8_t itemRecordCount;
-  uint8_t checkedItemIndex; ///< Same as checkedDoorIndex, but for items.
 
   SFG_MonsterRecord monsterRecords[SFG_MAX_MONSTERS];
   uint8_t monsterRecordCount;
-  uint8_t checkedMonsterIndex; 
-
-  SFG_ProjectileRecord projectileRecords[SFG_MAX_PROJECTILES];
+  int8_t activationSquare[2]; /**< Player square for which doors were last
+                                 (de)activated. */
+  RCL_Unit activationPosition[3]; /**< Player position (x, y, height) at which
+                                 all items and monsters were last
+                                 (de)activated. */
+  RCL_Unit activationMargin; /**< Taxicab distance from activationPosition up
+                                 to which the player can move without any
+                                 item or monster having to change
+                                 activation (the lowest of the margins
+                                 below). */
+  uint16_t itemActivationMargins[SFG_MAX_ITEMS]; /**< The same for each item
+                                 record. */
+  uint16_t monsterActivationMargins[SFG_MAX_MONSTERS]; /**< The same for each
+                                 monster record. */
+  uint8_t cardBlinkDoorIndex; /**< Steps through the doors to time the locked
+                                 card blinking, see SFG_updateActivation. */
+  uint64_t activeMonsters;  /**< Set of monsters (bit i = monster record i)
+                                 that aren't SFG_MONSTER_STATE_INACTIVE, so
+                                 that loops over monsters only visit these. */
+
+  /* Projectiles, field by field (see SFG_ProjectileRecord) so that the update
+     moves all of them in one loop over plain arrays: */
+  uint8_t projectileTypes[SFG_MAX_PROJECTILES];
+  uint8_t projectileDoubleFramesToLive[SFG_MAX_PROJECTILES];
+  uint16_t projectilePositions[3][SFG_MAX_PROJECTILES]; ///< x, y and z.
+  int16_t projectileDirections[3][SFG_MAX_PROJECTILES]; ///< x, y and z.
   uint8_t projectileRecordCount;
   uint8_t bossCount;
   uint8_t monstersDead;
@@ -478,6 +664,67 @@ struct
   uint8_t itemCollisionMap[(SFG_MAP_SIZE * SFG_MAP_SIZE) / 8];
                           /**< Bit array, for each map square says whether there
                                is a colliding item or not. */
+  uint16_t floorCeilingGrid[SFG_MAP_SIZE * SFG_MAP_SIZE];
+                          /**< Floor (lowest 5 bits) and ceiling (next 6 bits)
+                               height of each map square in
+                               SFG_WALL_HEIGHT_STEPs, so that they don't have to
+                               be decoded from the map data each time, or for
+                               squares that move SFG_MOVING_SQUARE and index of
+                               their current heights in movingFloorCeilings. */
+  RCL_Unit movingFloorCeilings[SFG_MAX_DOORS + SFG_MAX_MOVING_WALLS];
+                          /**< Current floor and ceiling of squares that move
+                               (doors, elevators, squeezers) packed with
+                               SFG_packFloorCeiling, updated as they move. */
+  RCL_Unit outsideFloorCeiling; ///< Packed floor and ceiling outside the map.
+  uint8_t textureGrid[SFG_MAP_SIZE * SFG_MAP_SIZE];
+                          ///< Values returned by SFG_texturesAt for each square.
+  uint8_t outsideTextures;
+  uint8_t movingWalls[SFG_MAX_MOVING_WALLS][2]; ///< elevator/squeezer coords
+  uint8_t movingWallCount;
+  uint8_t doorIndexGrid[SFG_MAP_SIZE * SFG_MAP_SIZE];
+                          /**< For each map square the index of its door record
+                               or SFG_NO_DOOR. */
+#if SFG_VISIBILITY_CACHE
+  uint64_t dynamicClusters; /**< Bits say which 8x8 square clusters of the map
+                                 (bit y * 8 + x) contain doors, elevators or
+                                 squeezers. */
+  uint64_t changedClusters; /**< Bits say which clusters had a square height
+                                 changed since the last visibility check. */
+  SFG_VisibilityEntry visibilityEntries[SFG_VISIBILITY_CACHE_SIZE];
+  uint8_t visibilityStates[SFG_VISIBILITY_CACHE_SIZE]; /**< Entry states, see
+                                 SFG_VISIBILITY_ENTRY_* bits. */
+#endif
+#if SFG_SIGHT_GRID
+  uint8_t sightGrid[SFG_MAP_SIZE * SFG_MAP_SIZE]; /**< For each square the
+                                 lowest height (in SFG_WALL_HEIGHT_STEPs) a line
+                                 of sight from sightSquare must have to possibly
+                                 reach it, or SFG_SIGHT_BLOCKED. */
+  uint8_t sightSquare[2];   ///< Square the sight grid was computed from.
+#endif
+#if SFG_MONSTER_FLOW_FIELD
+  uint8_t flowField[SFG_MAP_SIZE * SFG_MAP_SIZE]; /**< For each square the
+                                 number of steps a monster needs to walk from
+                                 it to flowSquare, or SFG_FLOW_UNREACHABLE. */
+  uint8_t flowSquare[2];    ///< Square the flow field was computed for.
+#endif
+#if SFG_CACHE_TEXTURES
+  uint8_t textureCache[9][SFG_TEXTURE_SIZE * SFG_TEXTURE_SIZE];
+                          /**< Decoded textures (column by column): the 7 level
+                               wall textures, the door texture (at index 7, so
+                               that door texture index 255 & 0x07 gets it) and
+                               the background. */
+#endif
+#if SFG_MONSTER_GRID
+  uint64_t monsterGrid[SFG_MONSTER_GRID_SIZE * SFG_MONSTER_GRID_SIZE];
+                          /**< For each area of SFG_MONSTER_GRID_CELL squares
+                               a set of monsters (bit i = monster record i)
+                               standing in it. */
+#endif
+#if SFG_CACHE_BACKGROUND
+  uint8_t backgroundColumns[SFG_TEXTURE_SIZE][SFG_GAME_RESOLUTION_Y];
+                          /**< Background texture columns scaled to the view
+                               height. */
+#endif
 } SFG_currentLevel;
 
 #if SFG_AVR
@@ -858,8 +1105,6 @@ void SFG_recomputePLayerDirection()
 }
 
 #if SFG_BACKGROUND_BLUR != 0
-uint8_t SFG_backgroundBlurIndex = 0;
-
 static const int8_t SFG_backgroundBlurOffsets[8] =
   {
     0  * SFG_BACKGROUND_BLUR,
@@ -881,6 +1126,11 @@ static inline uint8_t SFG_fogValueDiminish(RCL_Unit depth)
 static inline uint8_t
   SFG_getTexelFull(uint8_t textureIndex,RCL_Unit u, RCL_Unit v)
 {
+#if SFG_CACHE_TEXTURES
+  return SFG_currentLevel.textureCache[textureIndex & 0x07][
+    ((u / (RCL_UNITS_PER_SQUARE / SFG_TEXTURE_SIZE)) & 0x1f) * SFG_TEXTURE_SIZE
+    + ((v / (RCL_UNITS_PER_SQUARE / SFG_TEXTURE_SIZE)) & 0x1f)];
+#else
   return
     SFG_getTexel(
       textureIndex != 255 ?
@@ -889,6 +1139,21 @@ static inline uint8_t
           * SFG_TEXTURE_STORE_SIZE), 
           u / (RCL_UNITS_PER_SQUARE / SFG_TEXTURE_SIZE), 
           v / (RCL_UNITS_PER_SQUARE / SFG_TEXTURE_SIZE));
+#endif
+}
+
+/**
+  Gets a texel of the current level's background image.
+*/
+static inline uint8_t SFG_getBackgroundTexel(uint8_t u, uint8_t v)
+{
+#if SFG_CACHE_TEXTURES
+  return SFG_currentLevel.textureCache[8][
+    (u & 0x1f) * SFG_TEXTURE_SIZE + (v & 0x1f)];
+#else
+  return SFG_getTexel(SFG_backgroundImages + 
+    SFG_currentLevel.backgroundImage * SFG_TEXTURE_STORE_SIZE,u,v);
+#endif
 }
 
 static inline uint8_t SFG_getTexelAverage(uint8_t textureIndex)
@@ -905,6 +1170,143 @@ static inline uint8_t SFG_getTexelAverage(uint8_t textureIndex)
       );
 }
 
+/**
+  Computes the shadow that fog adds to a view pixel at given depth and position.
+*/
+static inline uint8_t SFG_fogShadow(RCL_Unit depth, int16_t x, int16_t y)
+{
+#if SFG_DITHERED_SHADOW
+  uint8_t fogShadow = (depth * 8) / SFG_FOG_DIMINISH_STEP;
+
+  #if SFG_SHADE_TABLES
+  return SFG_game.fogShadowRamp[(y & 0x01) * 4 + (x & 0x03)][fogShadow];
+  #else
+  uint8_t fogShadowPart = fogShadow & 0x07;
+
+  fogShadow /= 8;
+
+  uint8_t xMod4 = x & 0x03;
+  uint8_t yMod2 = y & 0x01;
+
+  return
+    fogShadow + SFG_ditheringPatterns[fogShadowPart * 8 + yMod2 * 4 + xMod4];
+  #endif
+#else
+  return SFG_fogValueDiminish(depth);
+#endif
+}
+
+/**
+  Diminishes a color by given shadow value, the same as palette_minusValue
+  (shadows above 248 that would wrap around aren't produced by the game).
+*/
+static inline uint8_t SFG_shadeColor(uint8_t color, uint8_t shadow)
+{
+#if SFG_SHADE_TABLES
+  return SFG_game.shadeTable[
+    shadow < SFG_SHADE_LEVELS ? shadow : (SFG_SHADE_LEVELS - 1)][color];
+#else
+  return palette_minusValue(color,shadow);
+#endif
+}
+
+/**
+  Gets the color of a view pixel through which the level background is seen.
+*/
+static inline uint8_t SFG_viewBackgroundColor(int16_t x, int16_t y)
+{
+#if SFG_CACHE_BACKGROUND
+  return SFG_currentLevel.backgroundColumns[
+    SFG_game.backgroundColumnMap[x]][y];
+#elif SFG_DRAW_LEVEL_BACKGROUND
+  #if SFG_BACKGROUND_BLUR != 0
+  /* The blur offsets are picked by the pixel position so that the view parts
+     can be rendered in any order. */
+  uint8_t blurIndex = (x * 5 + y) & 0x07;
+  #endif
+
+  return SFG_getBackgroundTexel(
+    SFG_game.backgroundScaleMap[((x
+  #if SFG_BACKGROUND_BLUR != 0
+      + SFG_backgroundBlurOffsets[blurIndex]
+  #endif
+      ) * SFG_VIEW_SUBSAMPLE + SFG_game.backgroundScroll) % SFG_GAME_RESOLUTION_Y], 
+    (SFG_game.backgroundScaleMap[(y          // ^ TODO: get rid of mod?
+  #if SFG_BACKGROUND_BLUR != 0
+      + SFG_backgroundBlurOffsets[(blurIndex + 1) & 0x07]
+  #endif
+      ) % SFG_GAME_RESOLUTION_Y])                                               
+    );
+#else
+  return 1;
+#endif
+}
+
+/**
+  Gets the (unshaded) color of a floor or ceiling pixel.
+*/
+static inline uint8_t SFG_flatColor(RCL_PixelInfo *pixel)
+{
+  return pixel->isFloor ?
+    (
+#if SFG_DIFFERENT_FLOOR_CEILING_COLORS
+      2 + (pixel->height / SFG_WALL_HEIGHT_STEP) % 4
+#else
+      SFG_currentLevel.floorColor
+#endif
+    ) : 
+    (pixel->height < SFG_CEILING_MAX_HEIGHT ?
+      (
+#if SFG_DIFFERENT_FLOOR_CEILING_COLORS
+        18 + (pixel->height / SFG_WALL_HEIGHT_STEP) % 4
+#else
+        SFG_currentLevel.ceilingColor 
+#endif
+      )
+      : SFG_TRANSPARENT_COLOR);
+}
+
+/**
+  Writes a final view pixel color to the screen, applying the brightness
+  setting and the raycasting subsampling.
+*/
+static inline void SFG_putViewPixel(int16_t x, int16_t y, uint8_t color)
+{
+#if SFG_BRIGHTNESS > 0
+  color = palette_plusValue(color,SFG_BRIGHTNESS);
+#elif SFG_BRIGHTNESS < 0
+  color = palette_minusValue(color,-1 * SFG_BRIGHTNESS);
+#endif
+
+#if SFG_RAYCASTING_SUBSAMPLE == 1 && !SFG_QUALITY_GOVERNOR
+  // the other version will probably get optimized to this, but just in case
+  SFG_setGamePixel(x,y,color);
+#else
+  RCL_Unit screenX = x * SFG_VIEW_SUBSAMPLE;
+
+  for (int_fast8_t i = 0; i < SFG_VIEW_SUBSAMPLE; ++i)
+  {
+    SFG_setGamePixel(screenX,y,color);
+    screenX++;
+  }
+#endif
+}
+
+/**
+  Records the depth of a view pixel (see SFG_DEPTH_BUFFER), the depth is given
+  as SFG_RCLUnitToZBuffer.
+*/
+static inline void SFG_putViewDepth(int16_t x, int16_t y, uint8_t depth)
+{
+#if SFG_DEPTH_BUFFER
+  SFG_game.depthBuffer[y * SFG_DEPTH_BUFFER_WIDTH + x] = depth;
+#else
+  SFG_UNUSED(x)
+  SFG_UNUSED(y)
+  SFG_UNUSED(depth)
+#endif
+}
+
 void SFG_pixelFunc(RCL_PixelInfo *pixel)
 { 
   uint8_t color;
@@ -940,12 +1342,12 @@ void SFG_pixelFunc(RCL_PixelInfo *pixel)
     color =
       textureIndex != SFG_TILE_TEXTURE_TRANSPARENT ?
       (
-#if SFG_TEXTURE_DISTANCE >= 65535
+#if SFG_TEXTURE_DISTANCE >= 65535 && !SFG_QUALITY_GOVERNOR
       SFG_getTexelFull(textureIndex,pixel->texCoords.x,textureV)
 #elif SFG_TEXTURE_DISTANCE == 0 
       SFG_getTexelAverage(textureIndex)
 #else
-      pixel->depth <= SFG_TEXTURE_DISTANCE ?
+      pixel->depth <= SFG_VIEW_TEXTURE_DISTANCE ?
         SFG_getTexelFull(textureIndex,pixel->texCoords.x,textureV) :
         SFG_getTexelAverage(textureIndex)
 #endif
@@ -957,91 +1359,167 @@ void SFG_pixelFunc(RCL_PixelInfo *pixel)
   }
   else // floor/ceiling
   {
-    color = pixel->isFloor ?
-      (
-#if SFG_DIFFERENT_FLOOR_CEILING_COLORS
-        2 + (pixel->height / SFG_WALL_HEIGHT_STEP) % 4
-#else
-        SFG_currentLevel.floorColor
-#endif
-      ) : 
-      (pixel->height < SFG_CEILING_MAX_HEIGHT ?
-        (
-#if SFG_DIFFERENT_FLOOR_CEILING_COLORS
-          18 + (pixel->height / SFG_WALL_HEIGHT_STEP) % 4
-#else
-          SFG_currentLevel.ceilingColor 
-#endif
-        )
-        : SFG_TRANSPARENT_COLOR);
+    color = SFG_flatColor(pixel);
   }
 
+  uint8_t depth = SFG_RCLUnitToZBuffer(pixel->depth);
+
   if (color != SFG_TRANSPARENT_COLOR)
   {
-#if SFG_DITHERED_SHADOW
-    uint8_t fogShadow = (pixel->depth * 8) / SFG_FOG_DIMINISH_STEP;
+    shadow += SFG_fogShadow(pixel->depth,pixel->position.x,pixel->position.y);
+
+#if SFG_ENABLE_FOG
+    color = SFG_shadeColor(color,shadow);
+#endif
+  }
+  else
+  {
+    color = SFG_viewBackgroundColor(pixel->position.x,pixel->position.y);
+    depth = 255;
+  }
+
+  SFG_putViewPixel(pixel->position.x,pixel->position.y,color);
+  SFG_putViewDepth(pixel->position.x,pixel->position.y,depth);
+}
+
+#if SFG_VIEW_SPANS
+/**
+  Draws a vertical run of view pixels (see RCL_SPAN_FUNCTION) the same way
+  SFG_pixelFunc would draw them one by one, but selects the texture and color
+  only once per run. Walls have a constant depth, so their shadow only
+  alternates with the dithering pattern between even and odd rows.
+*/
+void SFG_spanFunc(RCL_PixelInfo *pixel, RCL_SpanInfo *span)
+{
+  int16_t x = pixel->position.x;
+  int16_t y = span->start;
+
+  if (pixel->isWall)
+  {
+    RCL_Unit depth = RCL_zeroClamp(span->depth);
+    uint8_t property = pixel->hit.type & SFG_TILE_PROPERTY_MASK;
+
+    uint8_t isDoor = pixel->isFloor && property == SFG_TILE_PROPERTY_DOOR;
+
+    uint8_t textureIndex = pixel->isFloor ?
+      (pixel->hit.type & 0x7) : ((pixel->hit.type & 0x38) >> 3);
+
+    if (pixel->isHorizon && depth > RCL_UNITS_PER_SQUARE * 16)
+      textureIndex = SFG_TILE_TEXTURE_TRANSPARENT;
+
+#if SFG_TEXTURE_DISTANCE != 0
+    RCL_Unit textureVOffset =
+      property == SFG_TILE_PROPERTY_SQUEEZER ? pixel->wallHeight : 0;
+#endif
+
+#if SFG_TEXTURE_DISTANCE != 0 && \
+  (SFG_TEXTURE_DISTANCE < 65535 || SFG_QUALITY_GOVERNOR)
+    uint8_t textured = depth <= SFG_VIEW_TEXTURE_DISTANCE;
+#endif
+
+    uint8_t shadows[2];
+
+    shadows[0] = (pixel->hit.direction >> 1) + SFG_fogShadow(depth,x,0);
+    shadows[1] = (pixel->hit.direction >> 1) + SFG_fogShadow(depth,x,1);
+
+#if SFG_DEPTH_BUFFER
+    uint8_t zDepth = SFG_RCLUnitToZBuffer(depth);
+#endif
 
-    uint8_t fogShadowPart = fogShadow & 0x07;
+    RCL_Unit textureVScaled = span->texCoordY;
 
-    fogShadow /= 8;
+    for (int16_t i = 0; i < span->length; ++i)
+    {
+      RCL_Unit textureV = textureVScaled / RCL_TEXTURE_INTERPOLATION_SCALE;
+      uint8_t index = textureIndex;
+
+      if (isDoor && textureV <= RCL_UNITS_PER_SQUARE)
+        index = 255;
 
-    uint8_t xMod4 = pixel->position.x & 0x03;
-    uint8_t yMod2 = pixel->position.y & 0x01;
+      uint8_t color = SFG_TRANSPARENT_COLOR;
 
-    shadow +=
-      fogShadow + SFG_ditheringPatterns[fogShadowPart * 8 + yMod2 * 4 + xMod4];
+      if (index != SFG_TILE_TEXTURE_TRANSPARENT)
+#if SFG_TEXTURE_DISTANCE >= 65535 && !SFG_QUALITY_GOVERNOR
+        color = SFG_getTexelFull(index,pixel->texCoords.x,
+          textureV + textureVOffset);
+#elif SFG_TEXTURE_DISTANCE == 0 
+        color = SFG_getTexelAverage(index);
 #else
-    shadow += SFG_fogValueDiminish(pixel->depth);
+        color = textured ?
+          SFG_getTexelFull(index,pixel->texCoords.x,textureV + textureVOffset) :
+          SFG_getTexelAverage(index);
 #endif
 
+      if (color != SFG_TRANSPARENT_COLOR)
+      {
 #if SFG_ENABLE_FOG
-    color = palette_minusValue(color,shadow);
+        color = SFG_shadeColor(color,shadows[y & 0x01]);
+#endif
+#if SFG_DEPTH_BUFFER
+        SFG_putViewDepth(x,y,zDepth);
 #endif
+      }
+      else
+      {
+        color = SFG_viewBackgroundColor(x,y);
+        SFG_putViewDepth(x,y,255);
+      }
+
+      SFG_putViewPixel(x,y,color);
+
+      textureVScaled += span->texCoordYStep;
+      y += span->increment;
+    }
   }
-  else
+  else // floor/ceiling
   {
-#if SFG_DRAW_LEVEL_BACKGROUND
-    color = SFG_getTexel(SFG_backgroundImages + 
-        SFG_currentLevel.backgroundImage * SFG_TEXTURE_STORE_SIZE,
-      SFG_game.backgroundScaleMap[((pixel->position.x 
-  #if SFG_BACKGROUND_BLUR != 0
-        + SFG_backgroundBlurOffsets[SFG_backgroundBlurIndex]
-  #endif
-        ) * SFG_RAYCASTING_SUBSAMPLE + SFG_game.backgroundScroll) % SFG_GAME_RESOLUTION_Y], 
-      (SFG_game.backgroundScaleMap[(pixel->position.y          // ^ TODO: get rid of mod?
-  #if SFG_BACKGROUND_BLUR != 0
-        + SFG_backgroundBlurOffsets[SFG_backgroundBlurIndex + 1]
-  #endif
-        ) % SFG_GAME_RESOLUTION_Y])                                               
-      );
+    uint8_t flatColor = SFG_flatColor(pixel);
+    RCL_Unit depth = span->depth;
 
-  #if SFG_BACKGROUND_BLUR != 0
-      SFG_backgroundBlurIndex = (SFG_backgroundBlurIndex + 1) % 8;
-  #endif
-#else
-    color = 1;
+#if SFG_FLAT_SHADES
+    // this column's shaded flat colors for even and odd rows
+    const uint8_t *flatShades[2];
+
+    flatShades[0] =
+      SFG_currentLevel.flatShades[!pixel->isFloor][x & 0x03];
+    flatShades[1] =
+      SFG_currentLevel.flatShades[!pixel->isFloor][4 + (x & 0x03)];
 #endif
-  }
 
-#if SFG_BRIGHTNESS > 0
-  color = palette_plusValue(color,SFG_BRIGHTNESS);
-#elif SFG_BRIGHTNESS < 0
-  color = palette_minusValue(color,-1 * SFG_BRIGHTNESS);
+    for (int16_t i = 0; i < span->length; ++i)
+    {
+      RCL_Unit pixelDepth = RCL_zeroClamp(depth);
+      uint8_t color = flatColor;
+
+      if (pixel->isHorizon && pixelDepth > RCL_UNITS_PER_SQUARE * 16)
+        color = SFG_TRANSPARENT_COLOR;
+
+      if (color != SFG_TRANSPARENT_COLOR)
+      {
+#if SFG_ENABLE_FOG
+  #if SFG_FLAT_SHADES
+        color = flatShades[y & 0x01][
+          (uint8_t) ((pixelDepth * 8) / SFG_FOG_DIMINISH_STEP)];
+  #else
+        color = SFG_shadeColor(color,SFG_fogShadow(pixelDepth,x,y));
+  #endif
 #endif
+        SFG_putViewDepth(x,y,SFG_RCLUnitToZBuffer(pixelDepth));
+      }
+      else
+      {
+        color = SFG_viewBackgroundColor(x,y);
+        SFG_putViewDepth(x,y,255);
+      }
 
-#if SFG_RAYCASTING_SUBSAMPLE == 1
-  // the other version will probably get optimized to this, but just in case
-  SFG_setGamePixel(pixel->position.x,pixel->position.y,color);
-#else
-  RCL_Unit screenX = pixel->position.x * SFG_RAYCASTING_SUBSAMPLE;
+      SFG_putViewPixel(x,y,color);
 
-  for (int_fast8_t i = 0; i < SFG_RAYCASTING_SUBSAMPLE; ++i)
-  {
-    SFG_setGamePixel(screenX,pixel->position.y,color);
-    screenX++;
+      depth += span->depthStep;
+      y += span->increment;
+    }
   }
-#endif
 }
+#endif // SFG_VIEW_SPANS
 
 /**
   Draws image on screen, with transparency. This is faster than sprite drawing.
@@ -1127,6 +1605,46 @@ void SFG_blitImage(
   }
 }
 
+#if SFG_SPRITE_COLUMN_MASKS
+/**
+  Gets the column opacity masks of given sprite image, or 0 if the image isn't
+  one of the item, effect or monster sprites.
+*/
+static inline const uint32_t *SFG_getSpriteColumnMasks(const uint8_t *image)
+{
+  uint16_t index;
+
+  if (image >= SFG_itemSprites &&
+    image < SFG_itemSprites + sizeof(SFG_itemSprites))
+    index = (image - SFG_itemSprites) / SFG_TEXTURE_STORE_SIZE;
+  else if (image >= SFG_effectSprites &&
+    image < SFG_effectSprites + sizeof(SFG_effectSprites))
+    index = SFG_ITEM_SPRITE_COUNT +
+      (image - SFG_effectSprites) / SFG_TEXTURE_STORE_SIZE;
+  else if (image >= SFG_monsterSprites &&
+    image < SFG_monsterSprites + sizeof(SFG_monsterSprites))
+    index = SFG_ITEM_SPRITE_COUNT + SFG_EFFECT_SPRITE_COUNT +
+      (image - SFG_monsterSprites) / SFG_TEXTURE_STORE_SIZE;
+  else
+    return 0;
+
+  return SFG_game.spriteColumnMasks[index];
+}
+#endif
+
+#if SFG_COUNT_SPRITE_OVERDRAW
+uint32_t SFG_spriteOverdrawAvoided = 0; /**< Number of sprite pixels skipped
+                                             because nearer sprites covered
+                                             them. */
+#endif
+
+/**
+  Draws a sprite into the screen columns, skipping the pixels already drawn by
+  previously drawn sprites, so sprites have to be drawn from the nearest. The
+  drawn pixels are marked in SFG_game.spriteCover, transparent ones aren't, so
+  farther sprites show through them. With SFG_DEPTH_BUFFER pixels behind the
+  view's walls and floors are skipped too.
+*/
 void SFG_drawScaledSprite(
   const uint8_t *image,
   int16_t centerX,
@@ -1214,42 +1732,157 @@ void SFG_drawScaledSprite(
 
   #undef PRECOMP_SCALE
 
-  uint8_t zDistance = SFG_RCLUnitToZBuffer(distance);
+#if SFG_DEPTH_BUFFER
+  /* Sprites stand on the floor, so don't let the floor right at their foot
+     hide them due to rounding. */
+  uint8_t zDistance = SFG_RCLUnitToZBuffer(
+    RCL_zeroClamp(distance - RCL_UNITS_PER_SQUARE / 8));
+#else
+  SFG_UNUSED(distance)
+#endif
+
+#if SFG_SPRITE_COLUMN_MASKS
+  const uint32_t *columnMasks = SFG_getSpriteColumnMasks(image);
 
-  for (int16_t x = x0, u = u0; x <= x1; ++x, ++u)
+  if (columnMasks != 0)
   {
-    if (SFG_game.zBuffer[x] >= zDistance)
-    {
-      int8_t columnTransparent = 1;
+    /* For each texel row find the first screen row sampling it so that runs of
+       opaque texels in a column map to runs of screen rows. */
+    int16_t rowStarts[SFG_TEXTURE_SIZE + 1];
+    uint8_t row = 0;
 
-      for (int16_t y = y0, v = v0; y <= y1; ++y, ++v)
+    for (int16_t y = y0, v = v0; y <= y1; ++y, ++v)
+      while (row <= SFG_game.spriteSamplingPoints[v])
       {
-        uint8_t color =
-          SFG_getTexel(image,SFG_game.spriteSamplingPoints[u],
-            SFG_game.spriteSamplingPoints[v]);
-
-        if (color != SFG_TRANSPARENT_COLOR)
-        {
-#if SFG_DIMINISH_SPRITES
-          color = palette_minusValue(color,minusValue);
-#endif 
-          columnTransparent = 0;
-
-          SFG_setGamePixel(x,y,color);
-        }
+        rowStarts[row] = y;
+        row++;
       }
 
-      if (!columnTransparent)
-        SFG_game.zBuffer[x] = zDistance;
+    while (row <= SFG_TEXTURE_SIZE)
+    {
+      rowStarts[row] = y1 + 1;
+      row++;
     }
-  }
-}
 
-RCL_Unit SFG_texturesAt(int16_t x, int16_t y)
-{
-  uint8_t p;
+    for (int16_t x = x0, u = u0; x <= x1; ++x, ++u)
+    {
+      uint8_t sampleU = SFG_game.spriteSamplingPoints[u] & 0x1f;
+      uint32_t mask = columnMasks[sampleU];
 
-  SFG_TileDefinition tile =
+      if (mask == 0)
+        continue;
+
+#if SFG_DEPTH_BUFFER
+      const uint8_t *depthColumn =
+        SFG_game.depthBuffer + x / SFG_VIEW_SUBSAMPLE;
+#endif
+      uint8_t *cover =
+        SFG_game.spriteCover + x * SFG_SPRITE_COVER_COLUMN_BYTES;
+
+      row = 0;
+
+      while (mask != 0)
+      {
+        while (!(mask & 0x01)) // skip transparent texels
+        {
+          mask >>= 1;
+          row++;
+        }
+
+        uint8_t runStart = row;
+
+        while (mask & 0x01)
+        {
+          mask >>= 1;
+          row++;
+        }
+
+        int16_t runEnd = rowStarts[row];
+
+        for (int16_t y = rowStarts[runStart]; y < runEnd; ++y)
+        {
+          uint8_t coverBit = 0x01 << (y % 8);
+
+          if (cover[y / 8] & coverBit)
+          {
+#if SFG_COUNT_SPRITE_OVERDRAW
+            SFG_spriteOverdrawAvoided++;
+#endif
+            continue; // drawn by a nearer sprite
+          }
+
+#if SFG_DEPTH_BUFFER
+          if (depthColumn[y * SFG_DEPTH_BUFFER_WIDTH] < zDistance)
+            continue; // behind a wall
+#endif
+
+          uint8_t color = SFG_getTexel(image,sampleU,
+            SFG_game.spriteSamplingPoints[v0 + (y - y0)]);
+
+#if SFG_DIMINISH_SPRITES
+          color = SFG_shadeColor(color,minusValue);
+#endif 
+          cover[y / 8] |= coverBit;
+
+          SFG_setGamePixel(x,y,color);
+        }
+      }
+    }
+
+    return;
+  }
+#endif
+
+  for (int16_t x = x0, u = u0; x <= x1; ++x, ++u)
+  {
+#if SFG_DEPTH_BUFFER
+    const uint8_t *depthColumn =
+      SFG_game.depthBuffer + x / SFG_VIEW_SUBSAMPLE;
+#endif
+    uint8_t *cover = SFG_game.spriteCover + x * SFG_SPRITE_COVER_COLUMN_BYTES;
+
+    for (int16_t y = y0, v = v0; y <= y1; ++y, ++v)
+    {
+      uint8_t coverBit = 0x01 << (y % 8);
+
+      if (cover[y / 8] & coverBit)
+      {
+#if SFG_COUNT_SPRITE_OVERDRAW
+        SFG_spriteOverdrawAvoided++;
+#endif
+        continue; // drawn by a nearer sprite
+      }
+
+#if SFG_DEPTH_BUFFER
+      if (depthColumn[y * SFG_DEPTH_BUFFER_WIDTH] < zDistance)
+        continue; // behind a wall
+#endif
+
+      uint8_t color =
+        SFG_getTexel(image,SFG_game.spriteSamplingPoints[u],
+          SFG_game.spriteSamplingPoints[v]);
+
+      if (color != SFG_TRANSPARENT_COLOR)
+      {
+#if SFG_DIMINISH_SPRITES
+        color = SFG_shadeColor(color,minusValue);
+#endif 
+        cover[y / 8] |= coverBit;
+
+        SFG_setGamePixel(x,y,color);
+      }
+    }
+  }
+}
+
+/**
+  Computes the value for SFG_texturesAt from the level map.
+*/
+uint8_t SFG_computeTextures(int16_t x, int16_t y)
+{
+  uint8_t p;
+
+  SFG_TileDefinition tile =
     SFG_getMapTile(SFG_currentLevel.levelPointer,x,y,&p);
 
   return
@@ -1257,6 +1890,13 @@ RCL_Unit SFG_texturesAt(int16_t x, int16_t y)
     // ^ store both textures (floor and ceiling) and properties in one number
 }
 
+RCL_Unit SFG_texturesAt(int16_t x, int16_t y)
+{
+  return (((uint16_t) x) < SFG_MAP_SIZE && ((uint16_t) y) < SFG_MAP_SIZE) ?
+    SFG_currentLevel.textureGrid[y * SFG_MAP_SIZE + x] :
+    SFG_currentLevel.outsideTextures;
+}
+
 RCL_Unit SFG_movingWallHeight
 (
   RCL_Unit low,
@@ -1274,7 +1914,24 @@ RCL_Unit SFG_movingWallHeight
     low + halfHeight + (RCL_sin(sinArg) * halfHeight) / RCL_UNITS_PER_SQUARE;
 }
 
-RCL_Unit SFG_floorHeightAt(int16_t x, int16_t y)
+/**
+  Returns the door record of the door at given square or 0 if there is none.
+*/
+static inline SFG_DoorRecord *SFG_getDoorAt(int16_t x, int16_t y)
+{
+  uint8_t index =
+    (((uint16_t) x) < SFG_MAP_SIZE && ((uint16_t) y) < SFG_MAP_SIZE) ?
+    SFG_currentLevel.doorIndexGrid[y * SFG_MAP_SIZE + x] : SFG_NO_DOOR;
+
+  return index != SFG_NO_DOOR ? &(SFG_currentLevel.doorRecords[index]) : 0;
+}
+
+/**
+  Computes the current floor height of given square from the level map, doors
+  and time. This is used to fill SFG_currentLevel.floorCeilingGrid, otherwise
+  use SFG_floorHeightAt.
+*/
+RCL_Unit SFG_computeFloorHeight(int16_t x, int16_t y)
 {
   uint8_t properties;
 
@@ -1285,19 +1942,14 @@ RCL_Unit SFG_floorHeightAt(int16_t x, int16_t y)
 
   if (properties == SFG_TILE_PROPERTY_DOOR)
   {
-    for (uint8_t i = 0; i < SFG_currentLevel.doorRecordCount; ++i)
-    {
-      SFG_DoorRecord *door = &(SFG_currentLevel.doorRecords[i]);
-
-      if ((door->coords[0] == x) && (door->coords[1] == y))
-      {
-        doorHeight = door->state & SFG_DOOR_VERTICAL_POSITION_MASK;
+    SFG_DoorRecord *door = SFG_getDoorAt(x,y);
 
-        doorHeight = doorHeight != (0xff & SFG_DOOR_VERTICAL_POSITION_MASK)    ? 
-          doorHeight * SFG_DOOR_HEIGHT_STEP : RCL_UNITS_PER_SQUARE;
+    if (door != 0)
+    {
+      doorHeight = door->state & SFG_DOOR_VERTICAL_POSITION_MASK;
 
-        break;
-      }
+      doorHeight = doorHeight != (0xff & SFG_DOOR_VERTICAL_POSITION_MASK)    ? 
+        doorHeight * SFG_DOOR_HEIGHT_STEP : RCL_UNITS_PER_SQUARE;
     }
   }
   else if (properties == SFG_TILE_PROPERTY_ELEVATOR)
@@ -1314,6 +1966,147 @@ RCL_Unit SFG_floorHeightAt(int16_t x, int16_t y)
   return SFG_TILE_FLOOR_HEIGHT(tile) * SFG_WALL_HEIGHT_STEP - doorHeight;
 }
 
+/**
+  Same as SFG_computeFloorHeight but for ceiling.
+*/
+RCL_Unit SFG_computeCeilingHeight(int16_t x, int16_t y)
+{
+  uint8_t properties;
+  SFG_TileDefinition tile =
+    SFG_getMapTile(SFG_currentLevel.levelPointer,x,y,&properties);
+
+  if (properties == SFG_TILE_PROPERTY_ELEVATOR)
+    return SFG_CEILING_MAX_HEIGHT;
+
+  uint8_t height = SFG_TILE_CEILING_HEIGHT(tile);
+
+  return properties != SFG_TILE_PROPERTY_SQUEEZER ?
+    (
+      height != SFG_TILE_CEILING_MAX_HEIGHT ?
+      ((SFG_TILE_FLOOR_HEIGHT(tile) + height) * SFG_WALL_HEIGHT_STEP) :
+      SFG_CEILING_MAX_HEIGHT
+    ) :
+    SFG_movingWallHeight(
+      SFG_TILE_FLOOR_HEIGHT(tile) * SFG_WALL_HEIGHT_STEP,
+      (SFG_TILE_CEILING_HEIGHT(tile) + SFG_TILE_FLOOR_HEIGHT(tile))
+         * SFG_WALL_HEIGHT_STEP,
+      SFG_game.frameTime - SFG_currentLevel.timeStart);
+}
+
+/**
+  Packs floor and ceiling height the same way raycastlib does.
+*/
+static inline RCL_Unit SFG_packFloorCeiling(RCL_Unit floor, RCL_Unit ceiling)
+{
+  return ((floor & 0x0000ffff) << 16) | (ceiling & 0x0000ffff);
+}
+
+/**
+  Returns a bit mask of the map's 8x8 square clusters (bit y * 8 + x) that
+  intersect the rectangle with given two corner squares.
+*/
+uint64_t SFG_clusterRectMask(uint8_t x0, uint8_t y0, uint8_t x1, uint8_t y1)
+{
+  uint8_t fromX = RCL_min(x0,x1) / 8, toX = RCL_max(x0,x1) / 8,
+          fromY = RCL_min(y0,y1) / 8, toY = RCL_max(y0,y1) / 8;
+
+  uint64_t row = ((((uint64_t) 1) << (toX + 1)) - 1) >> fromX << fromX;
+  uint64_t result = 0;
+
+  for (uint8_t y = fromY; y <= toY && y < 8; ++y)
+    result |= (row & 0xff) << (y * 8);
+
+  return result;
+}
+
+#if SFG_MONSTER_FLOW_FIELD
+/**
+  Says whether a door or squeezer with given floor and ceiling height (packed
+  with SFG_packFloorCeiling) is open enough for a monster to walk through, as
+  the flow field sees it.
+*/
+static inline uint8_t SFG_flowOpen(RCL_Unit floorCeiling)
+{
+  return ((int16_t) (floorCeiling & 0x0000ffff)) -
+    ((int16_t) (floorCeiling >> 16)) >= SFG_MONSTER_COLLISION_HEIGHT;
+}
+#endif
+
+/**
+  Recomputes the floor and ceiling height of given square in
+  SFG_currentLevel.floorCeilingGrid.
+*/
+static inline void SFG_updateSquareHeight(uint8_t x, uint8_t y)
+{
+  uint16_t *square = SFG_currentLevel.floorCeilingGrid + y * SFG_MAP_SIZE + x;
+
+  RCL_Unit floor = SFG_computeFloorHeight(x,y);
+  RCL_Unit ceiling = SFG_computeCeilingHeight(x,y);
+
+  if (!(*square & SFG_MOVING_SQUARE))
+  {
+    // static heights are whole steps, at most SFG_CEILING_MAX_HEIGHT
+    *square = (floor / SFG_WALL_HEIGHT_STEP) |
+      ((ceiling / SFG_WALL_HEIGHT_STEP) << 5);
+    return;
+  }
+
+  RCL_Unit *moving =
+    SFG_currentLevel.movingFloorCeilings + (*square & ~SFG_MOVING_SQUARE);
+
+  RCL_Unit value = SFG_packFloorCeiling(floor,ceiling);
+
+#if SFG_VISIBILITY_CACHE
+  if (*moving != value)
+    SFG_currentLevel.changedClusters |=
+      ((uint64_t) 1) << ((y / 8) * 8 + x / 8);
+#endif
+
+#if SFG_MONSTER_FLOW_FIELD
+  if (SFG_flowOpen(*moving) != SFG_flowOpen(value))
+    SFG_currentLevel.flowSquare[0] = 255; // recompute with the next AI update
+#endif
+
+  *moving = value;
+}
+
+/**
+  Updates the heights of elevators and squeezers for the current time.
+*/
+void SFG_updateMovingWalls()
+{
+  for (uint8_t i = 0; i < SFG_currentLevel.movingWallCount; ++i)
+    SFG_updateSquareHeight(SFG_currentLevel.movingWalls[i][0],
+      SFG_currentLevel.movingWalls[i][1]);
+}
+
+/**
+  Returns floor and ceiling height of given square packed with
+  SFG_packFloorCeiling, this is used directly by the raycaster.
+*/
+RCL_Unit SFG_floorCeilingAt(int16_t x, int16_t y)
+{
+  if (((uint16_t) x) >= SFG_MAP_SIZE || ((uint16_t) y) >= SFG_MAP_SIZE)
+    return SFG_currentLevel.outsideFloorCeiling;
+
+  RCL_Unit square = SFG_currentLevel.floorCeilingGrid[y * SFG_MAP_SIZE + x];
+
+  return (square & SFG_MOVING_SQUARE) ?
+    SFG_currentLevel.movingFloorCeilings[square & ~SFG_MOVING_SQUARE] :
+    (((square & 0x1f) << 24) | ((square & 0x7e0) << 3));
+    // ^ same as SFG_packFloorCeiling of the heights times SFG_WALL_HEIGHT_STEP
+}
+
+RCL_Unit SFG_floorHeightAt(int16_t x, int16_t y)
+{
+  return (int16_t) (SFG_floorCeilingAt(x,y) >> 16);
+}
+
+RCL_Unit SFG_ceilingHeightAt(int16_t x, int16_t y)
+{
+  return (int16_t) (SFG_floorCeilingAt(x,y) & 0x0000ffff);
+}
+
 /**
   Like SFG_floorCollisionHeightAt, but takes into account colliding items on
   the map, so the squares that have these items are higher. The former function
@@ -1369,7 +2162,7 @@ void SFG_initPlayer()
   RCL_initCamera(&SFG_player.camera);
 
   SFG_player.camera.resolution.x =
-    SFG_GAME_RESOLUTION_X / SFG_RAYCASTING_SUBSAMPLE;
+    SFG_GAME_RESOLUTION_X / SFG_VIEW_SUBSAMPLE;
 
   SFG_player.camera.resolution.y = SFG_GAME_RESOLUTION_Y - SFG_HUD_BAR_HEIGHT;
 
@@ -1422,29 +2215,6 @@ void SFG_initPlayer()
     SFG_player.ammo[i] = 0;
 }
 
-RCL_Unit SFG_ceilingHeightAt(int16_t x, int16_t y)
-{
-  uint8_t properties;
-  SFG_TileDefinition tile =
-    SFG_getMapTile(SFG_currentLevel.levelPointer,x,y,&properties);
-
-  if (properties == SFG_TILE_PROPERTY_ELEVATOR)
-    return SFG_CEILING_MAX_HEIGHT;
-
-  uint8_t height = SFG_TILE_CEILING_HEIGHT(tile);
-
-  return properties != SFG_TILE_PROPERTY_SQUEEZER ?
-    (
-      height != SFG_TILE_CEILING_MAX_HEIGHT ?
-      ((SFG_TILE_FLOOR_HEIGHT(tile) + height) * SFG_WALL_HEIGHT_STEP) :
-      SFG_CEILING_MAX_HEIGHT
-    ) :
-    SFG_movingWallHeight(
-      SFG_TILE_FLOOR_HEIGHT(tile) * SFG_WALL_HEIGHT_STEP,
-      (SFG_TILE_CEILING_HEIGHT(tile) + SFG_TILE_FLOOR_HEIGHT(tile))
-         * SFG_WALL_HEIGHT_STEP,
-      SFG_game.frameTime - SFG_currentLevel.timeStart);
-}
 
 /**
   Gets sprite (image and sprite size) for given item.
@@ -1504,6 +2274,44 @@ uint8_t SFG_itemCollides(uint8_t elementType)
     elementType == SFG_LEVEL_ELEMENT_LAMP;
 }
 
+#if SFG_MONSTER_GRID
+/**
+  Gets the index of the monster grid area in which a monster with given
+  coordinates stands.
+*/
+static inline uint8_t SFG_monsterGridIndex(const uint8_t coords[2])
+{
+  return
+    (coords[1] / (4 * SFG_MONSTER_GRID_CELL)) * SFG_MONSTER_GRID_SIZE +
+    coords[0] / (4 * SFG_MONSTER_GRID_CELL);
+}
+
+/**
+  Gets the set of monsters (bit i = monster record i) standing in the monster
+  grid areas that a square with given center and half size (radius) touches.
+  These are all monsters that can be within the radius, plus some more.
+*/
+uint64_t SFG_monstersNear(RCL_Unit x, RCL_Unit y, RCL_Unit radius)
+{
+  #define CELL_UNITS (SFG_MONSTER_GRID_CELL * RCL_UNITS_PER_SQUARE)
+
+  int16_t x0 = RCL_zeroClamp(x - radius) / CELL_UNITS;
+  int16_t y0 = RCL_zeroClamp(y - radius) / CELL_UNITS;
+  int16_t x1 = RCL_min(SFG_MONSTER_GRID_SIZE - 1,(x + radius) / CELL_UNITS);
+  int16_t y1 = RCL_min(SFG_MONSTER_GRID_SIZE - 1,(y + radius) / CELL_UNITS);
+
+  #undef CELL_UNITS
+
+  uint64_t result = 0;
+
+  for (int16_t j = y0; j <= y1; ++j)
+    for (int16_t i = x0; i <= x1; ++i)
+      result |= SFG_currentLevel.monsterGrid[j * SFG_MONSTER_GRID_SIZE + i];
+
+  return result;
+}
+#endif
+
 void SFG_setGameState(uint8_t state)
 {
   SFG_LOG("changing game state");
@@ -1536,15 +2344,56 @@ void SFG_setAndInitLevel(uint8_t levelNumber)
   SFG_currentLevel.bossCount = 0;
   SFG_currentLevel.floorColor = level->floorColor;
   SFG_currentLevel.ceilingColor = level->ceilingColor;
+
+#if SFG_FLAT_SHADES
+  for (uint8_t i = 0; i < 8; ++i)
+    for (uint16_t j = 0; j < 256; ++j)
+    {
+      uint8_t shade = SFG_game.fogShadowRamp[i][j];
+
+      SFG_currentLevel.flatShades[0][i][j] =
+        SFG_game.shadeTable[shade][SFG_currentLevel.floorColor];
+      SFG_currentLevel.flatShades[1][i][j] =
+        SFG_game.shadeTable[shade][SFG_currentLevel.ceilingColor];
+    }
+#endif
   SFG_currentLevel.completionTime10sOfS = 0;
 
   for (uint8_t i = 0; i < 7; ++i)
     SFG_currentLevel.textures[i] =
       SFG_wallTextures + level->textureIndices[i] * SFG_TEXTURE_STORE_SIZE;
 
+#if SFG_CACHE_TEXTURES
+  SFG_LOG("decoding textures");
+
+  for (uint8_t i = 0; i < 9; ++i)
+  {
+    const uint8_t *texture =
+      i < 7 ? SFG_currentLevel.textures[i] :
+      (i == 7 ?
+        SFG_wallTextures + level->doorTextureIndex * SFG_TEXTURE_STORE_SIZE :
+        SFG_backgroundImages + level->backgroundImage * SFG_TEXTURE_STORE_SIZE);
+
+    uint8_t *texel = SFG_currentLevel.textureCache[i];
+
+    for (uint8_t x = 0; x < SFG_TEXTURE_SIZE; ++x)
+      for (uint8_t y = 0; y < SFG_TEXTURE_SIZE; ++y)
+      {
+        *texel = SFG_getTexel(texture,x,y);
+        texel++;
+      }
+  }
+#endif
+
+#if SFG_CACHE_BACKGROUND
+  for (uint8_t x = 0; x < SFG_TEXTURE_SIZE; ++x)
+    for (uint16_t y = 0; y < SFG_GAME_RESOLUTION_Y; ++y)
+      SFG_currentLevel.backgroundColumns[x][y] =
+        SFG_getBackgroundTexel(x,SFG_game.backgroundScaleMap[y]);
+#endif
+
   SFG_LOG("initializing doors");
 
-  SFG_currentLevel.checkedDoorIndex = 0;
   SFG_currentLevel.doorRecordCount = 0;
   SFG_currentLevel.projectileRecordCount = 0;
   SFG_currentLevel.teleporterCount = 0;
@@ -1555,6 +2404,9 @@ void SFG_setAndInitLevel(uint8_t levelNumber)
     0;
 #endif
 
+  for (uint16_t i = 0; i < SFG_MAP_SIZE * SFG_MAP_SIZE; ++i)
+    SFG_currentLevel.doorIndexGrid[i] = SFG_NO_DOOR;
+
   for (uint8_t j = 0; j < SFG_MAP_SIZE; ++j)
   {
     for (uint8_t i = 0; i < SFG_MAP_SIZE; ++i)
@@ -1572,6 +2424,9 @@ void SFG_setAndInitLevel(uint8_t levelNumber)
         d->coords[1] = j;
         d->state = 0x00;
 
+        SFG_currentLevel.doorIndexGrid[j * SFG_MAP_SIZE + i] =
+          SFG_currentLevel.doorRecordCount;
+
         SFG_currentLevel.doorRecordCount++;
       }
 
@@ -1589,10 +2444,13 @@ void SFG_setAndInitLevel(uint8_t levelNumber)
   SFG_LOG("initializing level elements");
 
   SFG_currentLevel.itemRecordCount = 0;
-  SFG_currentLevel.checkedItemIndex = 0;
 
   SFG_currentLevel.monsterRecordCount = 0;
-  SFG_currentLevel.checkedMonsterIndex = 0;
+  SFG_currentLevel.activationSquare[0] = -1;
+  SFG_currentLevel.activationSquare[1] = -1;
+  SFG_currentLevel.activationMargin = 0; // forces the first activation
+  SFG_currentLevel.cardBlinkDoorIndex = 0;
+  SFG_currentLevel.activeMonsters = 0;
 
   SFG_MonsterRecord *monster;
 
@@ -1619,6 +2477,9 @@ void SFG_setAndInitLevel(uint8_t levelNumber)
         monster->coords[0] = e->coords[0] * 4 + 2;
         monster->coords[1] = e->coords[1] * 4 + 2;
 
+        SFG_currentLevel.monsterActivationMargins[
+          SFG_currentLevel.monsterRecordCount] = 0;
+
         SFG_currentLevel.monsterRecordCount++;
 
         if (e->type == SFG_LEVEL_ELEMENT_MONSTER_ENDER)
@@ -1628,6 +2489,8 @@ void SFG_setAndInitLevel(uint8_t levelNumber)
         (e->type > SFG_LEVEL_ELEMENT_LOCK2))
       {
         SFG_currentLevel.itemRecords[SFG_currentLevel.itemRecordCount] = i;
+        SFG_currentLevel.itemActivationMargins[
+          SFG_currentLevel.itemRecordCount] = 0;
         SFG_currentLevel.itemRecordCount++;
 
         if (e->type == SFG_LEVEL_ELEMENT_TELEPORTER)
@@ -1644,17 +2507,11 @@ void SFG_setAndInitLevel(uint8_t levelNumber)
 
         if ((properties & SFG_TILE_PROPERTY_MASK) == SFG_TILE_PROPERTY_DOOR)
         {
-          // find the door record and lock the door:
-          for (uint16_t j = 0; j < SFG_currentLevel.doorRecordCount; ++j)
-          {
-            SFG_DoorRecord *d = &(SFG_currentLevel.doorRecords[j]);
+          // lock the door:
+          SFG_DoorRecord *d = SFG_getDoorAt(e->coords[0],e->coords[1]);
 
-            if (d->coords[0] == e->coords[0] && d->coords[1] == e->coords[1])
-            {
-              d->state |= (e->type - SFG_LEVEL_ELEMENT_LOCK0 + 1) << 6;
-              break;
-            }
-          }
+          if (d != 0)
+            d->state |= (e->type - SFG_LEVEL_ELEMENT_LOCK0 + 1) << 6;
         }
         else
         {
@@ -1664,39 +2521,208 @@ void SFG_setAndInitLevel(uint8_t levelNumber)
     }
   } 
 
+#if SFG_MONSTER_GRID
+  for (uint8_t i = 0; i < SFG_MONSTER_GRID_SIZE * SFG_MONSTER_GRID_SIZE; ++i)
+    SFG_currentLevel.monsterGrid[i] = 0;
+
+  for (uint8_t i = 0; i < SFG_currentLevel.monsterRecordCount; ++i)
+    SFG_currentLevel.monsterGrid[SFG_monsterGridIndex(
+      SFG_currentLevel.monsterRecords[i].coords)] |= ((uint64_t) 1) << i;
+#endif
+
   SFG_currentLevel.timeStart = SFG_game.frameTime; 
   SFG_currentLevel.frameStart = SFG_game.frame;
 
-  SFG_game.spriteAnimationFrame = 0;
+  SFG_LOG("initializing height grid");
 
-  SFG_initPlayer();
-  SFG_setGameState(SFG_GAME_STATE_LEVEL_START);
-  SFG_setMusic(SFG_MUSIC_NEXT);
-  SFG_processEvent(SFG_EVENT_LEVEL_STARTS,levelNumber);
-}
+  SFG_currentLevel.movingWallCount = 0;
 
-void SFG_createDefaultSaveData(uint8_t *memory)
-{
-  for (uint16_t i = 0; i < SFG_SAVE_SIZE; ++i)
-    memory[i] = 0;
-    
-  memory[1] = SFG_DEFAULT_SETTINGS;
-}
+  for (uint8_t j = 0; j < SFG_MAP_SIZE; ++j)
+    for (uint8_t i = 0; i < SFG_MAP_SIZE; ++i)
+    {
+      uint16_t index = j * SFG_MAP_SIZE + i;
+      uint8_t textures = SFG_computeTextures(i,j);
 
-void SFG_init()
-{
-  SFG_LOG("initializing game")
+      SFG_currentLevel.textureGrid[index] = textures;
+      SFG_currentLevel.floorCeilingGrid[index] = 0;
 
-  SFG_game.frame = 0;
-  SFG_game.frameTime = 0;
-  SFG_game.currentRandom = 0;
-  SFG_game.cheatState = 0;
+      if (SFG_currentLevel.doorIndexGrid[index] != SFG_NO_DOOR)
+        SFG_currentLevel.floorCeilingGrid[index] =
+          SFG_MOVING_SQUARE | SFG_currentLevel.doorIndexGrid[index];
+
+      textures &= SFG_TILE_PROPERTY_MASK;
+
+      if (textures == SFG_TILE_PROPERTY_ELEVATOR ||
+        textures == SFG_TILE_PROPERTY_SQUEEZER)
+      {
+        if (SFG_currentLevel.movingWallCount < SFG_MAX_MOVING_WALLS)
+        {
+          uint8_t *coords =
+            SFG_currentLevel.movingWalls[SFG_currentLevel.movingWallCount];
+
+          coords[0] = i;
+          coords[1] = j;
+
+          SFG_currentLevel.floorCeilingGrid[index] = SFG_MOVING_SQUARE |
+            (SFG_MAX_DOORS + SFG_currentLevel.movingWallCount);
+
+          SFG_currentLevel.movingWallCount++;
+        }
+        else
+        {
+          SFG_LOG("warning: too many moving walls!");
+        }
+      }
+
+      SFG_updateSquareHeight(i,j);
+    }
+
+#if SFG_VISIBILITY_CACHE
+  SFG_currentLevel.dynamicClusters = 0;
+
+  for (uint8_t i = 0; i < SFG_currentLevel.movingWallCount; ++i)
+    SFG_currentLevel.dynamicClusters |= SFG_clusterRectMask(
+      SFG_currentLevel.movingWalls[i][0],SFG_currentLevel.movingWalls[i][1],
+      SFG_currentLevel.movingWalls[i][0],SFG_currentLevel.movingWalls[i][1]);
+
+  for (uint8_t i = 0; i < SFG_currentLevel.doorRecordCount; ++i)
+    SFG_currentLevel.dynamicClusters |= SFG_clusterRectMask(
+      SFG_currentLevel.doorRecords[i].coords[0],
+      SFG_currentLevel.doorRecords[i].coords[1],
+      SFG_currentLevel.doorRecords[i].coords[0],
+      SFG_currentLevel.doorRecords[i].coords[1]);
+
+  for (uint8_t i = 0; i < SFG_VISIBILITY_CACHE_SIZE; ++i)
+    SFG_currentLevel.visibilityStates[i] = 0;
+
+  SFG_currentLevel.changedClusters = 0;
+#endif
+
+#if SFG_SIGHT_GRID
+  SFG_currentLevel.sightSquare[0] = 255; // forces recomputing the sight grid
+#endif
+
+#if SFG_MONSTER_FLOW_FIELD
+  SFG_currentLevel.flowSquare[0] = 255; // forces recomputing the flow field
+#endif
+
+#if SFG_VIEW_REUSE
+  SFG_game.worldEpoch++; // never reuse a view of the previous level
+#endif
+
+  SFG_currentLevel.outsideTextures = SFG_computeTextures(-1,-1);
+  SFG_currentLevel.outsideFloorCeiling = SFG_packFloorCeiling(
+    SFG_computeFloorHeight(-1,-1),SFG_computeCeilingHeight(-1,-1));
+
+  SFG_game.spriteAnimationFrame = 0;
+
+  SFG_initPlayer();
+  SFG_setGameState(SFG_GAME_STATE_LEVEL_START);
+  SFG_setMusic(SFG_MUSIC_NEXT);
+  SFG_processEvent(SFG_EVENT_LEVEL_STARTS,levelNumber);
+}
+
+void SFG_createDefaultSaveData(uint8_t *memory)
+{
+  for (uint16_t i = 0; i < SFG_SAVE_SIZE; ++i)
+    memory[i] = 0;
+    
+  memory[1] = SFG_DEFAULT_SETTINGS;
+}
+
+#if SFG_QUALITY_GOVERNOR
+/**
+  Sets the rendering parameters for given quality level (0 is the best, then
+  texture distance, ray steps and horizontal resolution go down).
+*/
+void SFG_setQualityLevel(uint8_t level)
+{
+  SFG_game.qualityLevel = level;
+
+  SFG_game.textureDistance = level == 0 ? SFG_TEXTURE_DISTANCE :
+    RCL_min(SFG_TEXTURE_DISTANCE,SFG_QUALITY_TEXTURE_DISTANCE >> (level - 1));
+
+  SFG_game.rayConstraints.maxSteps = SFG_RAYCASTING_MAX_STEPS -
+    (level * (SFG_RAYCASTING_MAX_STEPS - SFG_QUALITY_MIN_STEPS)) /
+    (SFG_QUALITY_LEVELS - 1);
+
+  SFG_game.subsample = level == SFG_QUALITY_LEVELS - 1 ?
+    SFG_QUALITY_MAX_SUBSAMPLE : SFG_RAYCASTING_SUBSAMPLE;
+
+  SFG_player.camera.resolution.x = SFG_GAME_RESOLUTION_X / SFG_game.subsample;
+}
+
+void SFG_setTargetFPS(uint8_t fps)
+{
+  SFG_game.targetFrameTime = (1000 * 16) / RCL_nonZero(fps);
+  SFG_game.frameTimeAverage = SFG_game.targetFrameTime;
+  SFG_game.qualityHold = SFG_QUALITY_HOLD_FRAMES;
+}
+
+/**
+  Updates the average frame time with the time (in ms) it took to compute the
+  last frame and changes the quality level if the average gets too far from
+  the target.
+*/
+void SFG_updateQuality(uint32_t frameTime)
+{
+  int32_t average = SFG_game.frameTimeAverage;
+
+  frameTime = RCL_min(frameTime,1000) * 16;
+
+  average += (((int32_t) frameTime) - average) / 8;
+
+  SFG_game.frameTimeAverage = average;
+
+  if (SFG_game.qualityHold > 0)
+  {
+    SFG_game.qualityHold--;
+    return;
+  }
+
+  uint8_t level = SFG_game.qualityLevel;
+
+  if (average * 100 >
+    ((int32_t) SFG_game.targetFrameTime) * SFG_QUALITY_LOWER_PERCENT &&
+    level < SFG_QUALITY_LEVELS - 1)
+    level++;
+  else if (average * 100 <
+    ((int32_t) SFG_game.targetFrameTime) * SFG_QUALITY_RAISE_PERCENT &&
+    level > 0)
+    level--;
+
+  if (level != SFG_game.qualityLevel)
+  {
+    SFG_setQualityLevel(level);
+    SFG_game.qualityHold = SFG_QUALITY_HOLD_FRAMES;
+  }
+}
+#else
+void SFG_setTargetFPS(uint8_t fps)
+{
+  SFG_UNUSED(fps)
+}
+#endif
+
+void SFG_init()
+{
+  SFG_LOG("initializing game")
+
+  SFG_game.frame = 0;
+  SFG_game.frameTime = 0;
+  SFG_game.currentRandom = 0;
+  SFG_game.cheatState = 0;
   SFG_game.continues = 1;
 
   RCL_initRayConstraints(&SFG_game.rayConstraints);
   SFG_game.rayConstraints.maxHits = SFG_RAYCASTING_MAX_HITS;
   SFG_game.rayConstraints.maxSteps = SFG_RAYCASTING_MAX_STEPS;
 
+#if SFG_QUALITY_GOVERNOR
+  SFG_setQualityLevel(0);
+  SFG_setTargetFPS(SFG_FPS);
+#endif
+
   RCL_initRayConstraints(&SFG_game.visibilityRayConstraints);
   SFG_game.visibilityRayConstraints.maxHits = 
     SFG_RAYCASTING_VISIBILITY_MAX_HITS;
@@ -1750,6 +2776,52 @@ void SFG_init()
     SFG_game.backgroundScaleMap[i] =
       (i * SFG_TEXTURE_SIZE) / SFG_GAME_RESOLUTION_Y;
 
+#if SFG_SPRITE_COLUMN_MASKS
+  SFG_LOG("computing sprite column masks")
+
+  for (uint8_t i = 0; i < SFG_SPRITE_COUNT; ++i)
+  {
+    const uint8_t *image =
+      i < SFG_ITEM_SPRITE_COUNT ?
+        SFG_itemSprites + i * SFG_TEXTURE_STORE_SIZE :
+      (i < SFG_ITEM_SPRITE_COUNT + SFG_EFFECT_SPRITE_COUNT ?
+        SFG_effectSprites + (i - SFG_ITEM_SPRITE_COUNT) *
+          SFG_TEXTURE_STORE_SIZE :
+        SFG_monsterSprites + (i - SFG_ITEM_SPRITE_COUNT -
+          SFG_EFFECT_SPRITE_COUNT) * SFG_TEXTURE_STORE_SIZE);
+
+    for (uint8_t x = 0; x < SFG_TEXTURE_SIZE; ++x)
+    {
+      uint32_t mask = 0;
+
+      for (uint8_t y = 0; y < SFG_TEXTURE_SIZE; ++y)
+        if (SFG_getTexel(image,x,y) != SFG_TRANSPARENT_COLOR)
+          mask |= ((uint32_t) 1) << y;
+
+      SFG_game.spriteColumnMasks[i][x] = mask;
+    }
+  }
+#endif
+
+#if SFG_SHADE_TABLES
+  SFG_LOG("computing shade tables")
+
+  for (uint8_t i = 0; i < SFG_SHADE_LEVELS; ++i)
+    for (uint16_t j = 0; j < 256; ++j)
+      SFG_game.shadeTable[i][j] = palette_minusValue(j,i);
+
+  #if SFG_DITHERED_SHADOW
+  for (uint8_t i = 0; i < 8; ++i)
+    for (uint16_t j = 0; j < 256; ++j)
+    {
+      uint8_t shadow = j / 8 + SFG_ditheringPatterns[(j & 0x07) * 8 + i];
+
+      SFG_game.fogShadowRamp[i][j] =
+        shadow < SFG_SHADE_LEVELS ? shadow : (SFG_SHADE_LEVELS - 1);
+    }
+  #endif
+#endif
+
   for (uint8_t i = 0; i < SFG_KEY_COUNT; ++i)
     SFG_game.keyStates[i] = 0;
 
@@ -1795,17 +2867,50 @@ void SFG_init()
 */
 uint8_t SFG_createProjectile(SFG_ProjectileRecord projectile)
 {
-  if (SFG_currentLevel.projectileRecordCount >= SFG_MAX_PROJECTILES)
+  uint8_t i = SFG_currentLevel.projectileRecordCount;
+
+  if (i >= SFG_MAX_PROJECTILES)
     return 0; 
 
-  SFG_currentLevel.projectileRecords[SFG_currentLevel.projectileRecordCount] =
-    projectile;
+  SFG_currentLevel.projectileTypes[i] = projectile.type;
+  SFG_currentLevel.projectileDoubleFramesToLive[i] =
+    projectile.doubleFramesToLive;
+
+  for (uint8_t j = 0; j < 3; ++j)
+  {
+    SFG_currentLevel.projectilePositions[j][i] = projectile.position[j];
+    SFG_currentLevel.projectileDirections[j][i] = projectile.direction[j];
+  }
   
   SFG_currentLevel.projectileRecordCount++;
 
   return 1;
 }
 
+/**
+  Removes projectile with given index, keeping the order of the rest.
+*/
+void SFG_removeProjectile(uint8_t index)
+{
+  SFG_currentLevel.projectileRecordCount--;
+
+  for (uint8_t i = index; i < SFG_currentLevel.projectileRecordCount; ++i)
+  {
+    SFG_currentLevel.projectileTypes[i] =
+      SFG_currentLevel.projectileTypes[i + 1];
+    SFG_currentLevel.projectileDoubleFramesToLive[i] =
+      SFG_currentLevel.projectileDoubleFramesToLive[i + 1];
+
+    for (uint8_t j = 0; j < 3; ++j)
+    {
+      SFG_currentLevel.projectilePositions[j][i] =
+        SFG_currentLevel.projectilePositions[j][i + 1];
+      SFG_currentLevel.projectileDirections[j][i] =
+        SFG_currentLevel.projectileDirections[j][i + 1];
+    }
+  }
+}
+
 /**
   Launches projectile of given type from given position in given direction
   (has to be normalized), with given offset (so as to not collide with the
@@ -2022,19 +3127,216 @@ void SFG_removeItem(uint8_t index)
   SFG_LOG("removing item");
 
   for (uint16_t j = index; j < SFG_currentLevel.itemRecordCount - 1; ++j)
+  {
     SFG_currentLevel.itemRecords[j] =
       SFG_currentLevel.itemRecords[j + 1];
+    SFG_currentLevel.itemActivationMargins[j] =
+      SFG_currentLevel.itemActivationMargins[j + 1];
+  }
 
   SFG_currentLevel.itemRecordCount--; 
 }
 
+#if SFG_SIGHT_GRID
+/**
+  Gets the lowest floor height (in SFG_WALL_HEIGHT_STEPs) given square can
+  ever have, counting doors as open, or SFG_SIGHT_BLOCKED for closed squares
+  (floor at ceiling) that no line of sight can pass.
+*/
+static inline uint8_t SFG_sightFloorAt(uint8_t x, uint8_t y)
+{
+  uint8_t properties;
+
+  SFG_TileDefinition tile =
+    SFG_getMapTile(SFG_currentLevel.levelPointer,x,y,&properties);
+
+  if (properties == SFG_TILE_PROPERTY_DOOR)
+    return 0;
+
+  if (properties == SFG_TILE_PROPERTY_NORMAL &&
+    SFG_TILE_CEILING_HEIGHT(tile) == 0)
+    return SFG_SIGHT_BLOCKED;
+
+  return SFG_TILE_FLOOR_HEIGHT(tile);
+}
+
+/**
+  Recomputes the sight grid for given player square. A line of sight (as cast
+  by RCL_castRay3D) only passes squares whose floor isn't above it, so the
+  value of each square is the minimum over all paths of the highest floor on
+  the path, computed by flood filling the map in order of increasing height.
+*/
+void SFG_updateSightGrid(uint8_t x, uint8_t y)
+{
+  uint16_t heads[SFG_TILE_CEILING_MAX_HEIGHT + 1]; // list of squares per height
+
+  for (uint8_t i = 0; i <= SFG_TILE_CEILING_MAX_HEIGHT; ++i)
+    heads[i] = SFG_NO_SQUARE;
+
+  for (uint16_t i = 0; i < SFG_MAP_SIZE * SFG_MAP_SIZE; ++i)
+    SFG_currentLevel.sightGrid[i] = SFG_SIGHT_BLOCKED;
+
+  SFG_currentLevel.sightSquare[0] = x;
+  SFG_currentLevel.sightSquare[1] = y;
+
+  uint16_t index = y * SFG_MAP_SIZE + x;
+  uint8_t height = SFG_sightFloorAt(x,y);
+
+  if (height == SFG_SIGHT_BLOCKED)
+    height = 0;
+
+  SFG_currentLevel.sightGrid[index] = height;
+  SFG_game.squareLinks[index] = SFG_NO_SQUARE;
+  heads[height] = index;
+
+  for (uint8_t h = 0; h <= SFG_TILE_CEILING_MAX_HEIGHT; ++h)
+    while (heads[h] != SFG_NO_SQUARE)
+    {
+      index = heads[h];
+      heads[h] = SFG_game.squareLinks[index];
+
+      x = index % SFG_MAP_SIZE;
+      y = index / SFG_MAP_SIZE;
+
+      for (uint8_t i = 0; i < 4; ++i)
+      {
+        int8_t nx = x + (i == 0) - (i == 1);
+        int8_t ny = y + (i == 2) - (i == 3);
+
+        if (nx < 0 || ny < 0 || nx >= SFG_MAP_SIZE || ny >= SFG_MAP_SIZE)
+          continue;
+
+        uint16_t neighbor = ny * SFG_MAP_SIZE + nx;
+
+        if (SFG_currentLevel.sightGrid[neighbor] != SFG_SIGHT_BLOCKED)
+          continue; // already reached, always first at its lowest height
+
+        height = SFG_sightFloorAt(nx,ny);
+
+        if (height == SFG_SIGHT_BLOCKED)
+          continue;
+
+        if (height < h)
+          height = h;
+
+        SFG_currentLevel.sightGrid[neighbor] = height;
+        SFG_game.squareLinks[neighbor] = heads[height];
+        heads[height] = neighbor;
+      }
+    }
+}
+
+/**
+  Makes sure the sight grid is computed for the square the player is in.
+*/
+static inline void SFG_updatePlayerSightGrid()
+{
+  uint8_t x = SFG_player.camera.position.x / RCL_UNITS_PER_SQUARE;
+  uint8_t y = SFG_player.camera.position.y / RCL_UNITS_PER_SQUARE;
+
+  if (x != SFG_currentLevel.sightSquare[0] ||
+    y != SFG_currentLevel.sightSquare[1])
+    SFG_updateSightGrid(x,y);
+}
+#endif
+
+#if SFG_VISIBILITY_CACHE
+/**
+  Returns the map clusters (see SFG_clusterRectMask) that the line of sight ray
+  of given visibility cache entry can pass. The ray stays in the rectangle
+  between the camera and the sprite square, plus one square around for the
+  rounding of its direction.
+*/
+static inline uint64_t SFG_visibilityEntryClusters(
+  const SFG_VisibilityEntry *entry)
+{
+  uint8_t x0 = entry->viewer[0] / RCL_UNITS_PER_SQUARE,
+          y0 = entry->viewer[1] / RCL_UNITS_PER_SQUARE,
+          x1 = entry->position[0] / RCL_UNITS_PER_SQUARE,
+          y1 = entry->position[1] / RCL_UNITS_PER_SQUARE;
+
+  return SFG_clusterRectMask(
+    RCL_max(RCL_min(x0,x1),1) - 1,
+    RCL_max(RCL_min(y0,y1),1) - 1,
+    RCL_min(RCL_max(x0,x1) + 1,SFG_MAP_SIZE - 1),
+    RCL_min(RCL_max(y0,y1) + 1,SFG_MAP_SIZE - 1));
+}
+#endif
+
 /**
   Checks a 3D point visibility from player's position (WITHOUT considering
   facing direction).
 */
 static inline uint8_t SFG_spriteIsVisible(RCL_Vector2D pos, RCL_Unit height)
 {
-  return
+#if SFG_SIGHT_GRID
+  SFG_updatePlayerSightGrid();
+#endif
+
+#if SFG_SIGHT_GRID || SFG_VISIBILITY_CACHE
+  uint8_t inMap = pos.x >= 0 && pos.y >= 0 &&
+    pos.x < SFG_MAP_SIZE * RCL_UNITS_PER_SQUARE &&
+    pos.y < SFG_MAP_SIZE * RCL_UNITS_PER_SQUARE;
+#endif
+
+#if SFG_SIGHT_GRID
+  if (inMap)
+  {
+    uint8_t sight = SFG_currentLevel.sightGrid[
+      (pos.y / RCL_UNITS_PER_SQUARE) * SFG_MAP_SIZE +
+      pos.x / RCL_UNITS_PER_SQUARE];
+
+    if (sight == SFG_SIGHT_BLOCKED || sight * SFG_WALL_HEIGHT_STEP >
+      RCL_max(SFG_player.camera.height,height))
+      return 0;
+  }
+#endif
+
+#if SFG_VISIBILITY_CACHE
+  SFG_VisibilityEntry *entry = 0;
+  uint8_t index = 0;
+
+  if (SFG_currentLevel.changedClusters)
+  {
+    // drop the entries whose ray area has a square that moved:
+
+    for (uint8_t i = 0; i < SFG_VISIBILITY_CACHE_SIZE; ++i)
+      if (SFG_currentLevel.visibilityStates[i] & SFG_VISIBILITY_ENTRY_DYNAMIC)
+      {
+        if (SFG_visibilityEntryClusters(
+          SFG_currentLevel.visibilityEntries + i) &
+          SFG_currentLevel.changedClusters)
+          SFG_currentLevel.visibilityStates[i] = 0;
+      }
+
+    SFG_currentLevel.changedClusters = 0;
+  }
+
+  if (inMap) // the camera always is
+  {
+    uint32_t hash = SFG_player.camera.position.x * 3 +
+      SFG_player.camera.position.y * 5 + SFG_player.camera.height * 7 +
+      pos.x * 11 + pos.y * 13 + height * 17;
+
+    // positions tend to have the same low bits, take the middle ones
+    index = ((hash * 2654435761u) >> 16) & (SFG_VISIBILITY_CACHE_SIZE - 1);
+
+    entry = SFG_currentLevel.visibilityEntries + index;
+
+    uint8_t state = SFG_currentLevel.visibilityStates[index];
+
+    if ((state & SFG_VISIBILITY_ENTRY_VALID) &&
+      entry->position[0] == pos.x &&
+      entry->position[1] == pos.y &&
+      entry->height == height &&
+      entry->viewer[0] == SFG_player.camera.position.x &&
+      entry->viewer[1] == SFG_player.camera.position.y &&
+      entry->viewerHeight == SFG_player.camera.height)
+      return (state & SFG_VISIBILITY_ENTRY_VISIBLE) != 0;
+  }
+#endif
+
+  uint8_t visible =
     RCL_castRay3D(
       SFG_player.camera.position,
       SFG_player.camera.height,
@@ -2044,6 +3346,30 @@ static inline uint8_t SFG_spriteIsVisible(RCL_Vector2D pos, RCL_Unit height)
       SFG_ceilingHeightAt,
       SFG_game.visibilityRayConstraints
     ) == RCL_UNITS_PER_SQUARE;
+
+#if SFG_VISIBILITY_CACHE
+  if (entry != 0)
+  {
+    uint8_t state = SFG_VISIBILITY_ENTRY_VALID;
+
+    if (visible)
+      state |= SFG_VISIBILITY_ENTRY_VISIBLE;
+
+    entry->viewer[0] = SFG_player.camera.position.x;
+    entry->viewer[1] = SFG_player.camera.position.y;
+    entry->viewerHeight = SFG_player.camera.height;
+    entry->position[0] = pos.x;
+    entry->position[1] = pos.y;
+    entry->height = height;
+
+    if (SFG_currentLevel.dynamicClusters & SFG_visibilityEntryClusters(entry))
+      state |= SFG_VISIBILITY_ENTRY_DYNAMIC;
+
+    SFG_currentLevel.visibilityStates[index] = state;
+  }
+#endif
+
+  return visible;
 }
 
 RCL_Unit SFG_directionTangent(RCL_Unit dirX, RCL_Unit dirY, RCL_Unit dirZ)
@@ -2061,8 +3387,13 @@ RCL_Unit SFG_directionTangent(RCL_Unit dirX, RCL_Unit dirY, RCL_Unit dirZ)
 */
 RCL_Unit SFG_autoaimVertically()
 {
-  for (uint16_t i = 0; i < SFG_currentLevel.monsterRecordCount; ++i)
+  uint64_t monsters = SFG_currentLevel.activeMonsters;
+
+  for (uint16_t i = 0; monsters != 0; ++i, monsters >>= 1)
   {
+    if (!(monsters & 0x01))
+      continue;
+
     SFG_MonsterRecord m = SFG_currentLevel.monsterRecords[i];
     
     uint8_t state = SFG_MR_STATE(m);
@@ -2121,141 +3452,563 @@ static inline const SFG_LevelElement *SFG_getLevelElement(uint8_t index)
 {
   SFG_ItemRecord item = SFG_currentLevel.itemRecords[index];
 
-  return &(SFG_currentLevel.levelPointer->elements[item &
-           ~SFG_ITEM_RECORD_ACTIVE_MASK]);
-}
-  
-void SFG_createExplosion(RCL_Unit, RCL_Unit, RCL_Unit); // forward decl
+  return &(SFG_currentLevel.levelPointer->elements[item &
+           ~SFG_ITEM_RECORD_ACTIVE_MASK]);
+}
+  
+void SFG_createExplosion(RCL_Unit, RCL_Unit, RCL_Unit); // forward decl
+
+void SFG_explodeBarrel(uint8_t itemIndex, RCL_Unit x, RCL_Unit y, RCL_Unit z)
+{
+  const SFG_LevelElement *e = SFG_getLevelElement(itemIndex);
+  SFG_setItemCollisionMapBit(e->coords[0],e->coords[1],0);
+#if SFG_MONSTER_FLOW_FIELD
+  SFG_currentLevel.flowSquare[0] = 255; // the square can be walked now
+#endif
+  SFG_removeItem(itemIndex);
+  SFG_createExplosion(x,y,z);
+}
+
+void SFG_createExplosion(RCL_Unit x, RCL_Unit y, RCL_Unit z)
+{
+  SFG_ProjectileRecord explosion;
+
+  SFG_playGameSound(2,SFG_distantSoundVolume(x,y,z));
+  SFG_processEvent(SFG_EVENT_EXPLOSION,0);
+
+  explosion.type = SFG_PROJECTILE_EXPLOSION;
+
+  explosion.position[0] = x;
+  explosion.position[1] = y;
+  explosion.position[2] = z;
+
+  explosion.direction[0] = 0;
+  explosion.direction[1] = 0;
+  explosion.direction[2] = 0;
+
+  explosion.doubleFramesToLive = RCL_nonZero(
+    SFG_GET_PROJECTILE_FRAMES_TO_LIVE(SFG_PROJECTILE_EXPLOSION) / 2);
+
+  SFG_createProjectile(explosion);
+
+  uint8_t damage = SFG_getDamageValue(SFG_WEAPON_FIRE_TYPE_FIREBALL);
+
+  if (SFG_taxicabDistance(x,y,z,SFG_player.camera.position.x,
+    SFG_player.camera.position.y,SFG_player.camera.height)
+    <= SFG_EXPLOSION_RADIUS)
+  {
+    SFG_playerChangeHealth(-1 * damage);
+    SFG_pushPlayerAway(x,y,SFG_EXPLOSION_PUSH_AWAY_DISTANCE);
+  }
+
+#if SFG_MONSTER_GRID
+  uint64_t monsters = SFG_monstersNear(x,y,SFG_EXPLOSION_RADIUS) &
+    SFG_currentLevel.activeMonsters;
+#else
+  uint64_t monsters = SFG_currentLevel.activeMonsters;
+#endif
+
+  for (uint16_t i = 0; monsters != 0; ++i, monsters >>= 1)
+  {
+    if (!(monsters & 0x01))
+      continue;
+    SFG_MonsterRecord *monster = &(SFG_currentLevel.monsterRecords[i]);
+
+    uint16_t state = SFG_MR_STATE(*monster); 
+
+    if ((state == SFG_MONSTER_STATE_INACTIVE) ||
+        (state == SFG_MONSTER_STATE_DEAD))
+      continue; 
+
+    RCL_Unit monsterHeight =
+      SFG_floorHeightAt(
+        SFG_MONSTER_COORD_TO_SQUARES(monster->coords[0]),
+        SFG_MONSTER_COORD_TO_SQUARES(monster->coords[1]))
+        + RCL_UNITS_PER_SQUARE / 2;
+
+    if (SFG_taxicabDistance(
+      SFG_MONSTER_COORD_TO_RCL_UNITS(monster->coords[0]),
+      SFG_MONSTER_COORD_TO_RCL_UNITS(monster->coords[1]),monsterHeight,
+      x,y,z) <= SFG_EXPLOSION_RADIUS)
+    {
+      SFG_monsterChangeHealth(monster,
+        -1 * SFG_getDamageValue(SFG_WEAPON_FIRE_TYPE_FIREBALL));
+    }
+  }
+
+  // explode nearby barrels
+
+  if (damage >= SFG_BARREL_EXPLOSION_DAMAGE_THRESHOLD)
+    for (uint16_t i = 0; i < SFG_currentLevel.itemRecordCount; ++i)
+    {
+      SFG_ItemRecord item = SFG_currentLevel.itemRecords[i];
+
+      /* We DON'T check just active barrels but all, otherwise it looks weird
+         that out of sight barrels in a line didn't explode.*/
+
+      SFG_LevelElement element = SFG_ITEM_RECORD_LEVEL_ELEMENT(item);
+
+      if (element.type != SFG_LEVEL_ELEMENT_BARREL)
+        continue;
+
+      RCL_Unit elementX =
+        element.coords[0] * RCL_UNITS_PER_SQUARE + RCL_UNITS_PER_SQUARE / 2;
+
+      RCL_Unit elementY =
+        element.coords[1] * RCL_UNITS_PER_SQUARE + RCL_UNITS_PER_SQUARE / 2;
+
+      if (RCL_abs(x - elementX) + RCL_abs(y - elementY) >
+        SFG_EXPLOSION_RADIUS)
+        continue; // too far already horizontally, skip the height lookup
+
+      RCL_Unit elementHeight =
+        SFG_floorHeightAt(element.coords[0],element.coords[1]);
+
+      if (SFG_taxicabDistance(
+        x,y,z,elementX,elementY,elementHeight) <= SFG_EXPLOSION_RADIUS)
+      {
+        SFG_explodeBarrel(i,elementX,elementY,elementHeight);
+        i--;
+      }
+    }
+}
+
+void SFG_createDust(RCL_Unit x, RCL_Unit y, RCL_Unit z)
+{
+  SFG_ProjectileRecord dust;
+
+  dust.type = SFG_PROJECTILE_DUST;
+
+  dust.position[0] = x;
+  dust.position[1] = y;
+  dust.position[2] = z;
+
+  dust.direction[0] = 0;
+  dust.direction[1] = 0;
+  dust.direction[2] = 0;
+
+  dust.doubleFramesToLive =
+    RCL_nonZero(SFG_GET_PROJECTILE_FRAMES_TO_LIVE(SFG_PROJECTILE_DUST) / 2);
+
+  SFG_createProjectile(dust);
+}
+
+void SFG_getMonsterWorldPosition(SFG_MonsterRecord *monster, RCL_Unit *x,
+  RCL_Unit *y, RCL_Unit *z)
+{
+  *x = SFG_MONSTER_COORD_TO_RCL_UNITS(monster->coords[0]);
+  *y = SFG_MONSTER_COORD_TO_RCL_UNITS(monster->coords[1]);
+  *z = SFG_floorHeightAt(
+         SFG_MONSTER_COORD_TO_SQUARES(monster->coords[0]),
+         SFG_MONSTER_COORD_TO_SQUARES(monster->coords[1]))
+       + RCL_UNITS_PER_SQUARE / 2;
+}
+
+/**
+  Says whether a level element at given position, half a square above the
+  floor of given square, is in the active distance from the player. Also
+  returns how far (taxicab) the player can move from the current position
+  before this may change, taking into account that the floor of a door or an
+  elevator square moves (0 if it may change without the player moving).
+*/
+uint8_t SFG_elementActivation(RCL_Unit x, RCL_Unit y, int16_t squareX,
+  int16_t squareY, RCL_Unit *margin)
+{
+  RCL_Unit floor = SFG_floorHeightAt(squareX,squareY);
+  RCL_Unit floorLow = floor, floorHigh = floor;
+
+  if (SFG_currentLevel.floorCeilingGrid[squareY * SFG_MAP_SIZE + squareX] &
+    SFG_MOVING_SQUARE)
+  {
+    uint8_t properties;
+
+    SFG_TileDefinition tile =
+      SFG_getMapTile(SFG_currentLevel.levelPointer,squareX,squareY,&properties);
+
+    floorHigh = SFG_TILE_FLOOR_HEIGHT(tile) * SFG_WALL_HEIGHT_STEP;
+    floorLow = floorHigh;
+
+    if (properties == SFG_TILE_PROPERTY_ELEVATOR)
+      floorHigh += SFG_TILE_CEILING_HEIGHT(tile) * SFG_WALL_HEIGHT_STEP;
+    else if (properties == SFG_TILE_PROPERTY_DOOR)
+      floorLow -= RCL_UNITS_PER_SQUARE;
+  }
+
+  RCL_Unit z = SFG_player.camera.height - RCL_UNITS_PER_SQUARE / 2;
+
+  RCL_Unit distance = RCL_abs(x - SFG_player.camera.position.x) +
+    RCL_abs(y - SFG_player.camera.position.y);
+
+  // nearest and farthest the element can get while the player stays
+  RCL_Unit distanceMin = distance +
+    RCL_max(0,RCL_max(floorLow - z,z - floorHigh));
+  RCL_Unit distanceMax = distance +
+    RCL_max(RCL_abs(floorLow - z),RCL_abs(floorHigh - z));
+
+  *margin =
+    (distanceMax <= SFG_LEVEL_ELEMENT_ACTIVE_DISTANCE) ?
+      SFG_LEVEL_ELEMENT_ACTIVE_DISTANCE - distanceMax + 1 :
+    (distanceMin > SFG_LEVEL_ELEMENT_ACTIVE_DISTANCE) ?
+      distanceMin - SFG_LEVEL_ELEMENT_ACTIVE_DISTANCE : 0;
+
+  return distance + RCL_abs(floor - z) <= SFG_LEVEL_ELEMENT_ACTIVE_DISTANCE;
+}
+
+/**
+  Activates an item if it's close enough to the player, deactivates it
+  otherwise. Returns the margin of SFG_elementActivation.
+*/
+RCL_Unit SFG_updateItemActivation(uint8_t index)
+{
+  SFG_ItemRecord item = SFG_currentLevel.itemRecords[index];
+
+  item &= ~SFG_ITEM_RECORD_ACTIVE_MASK;
+
+  SFG_LevelElement e = SFG_currentLevel.levelPointer->elements[item];
+
+  RCL_Unit margin;
+
+  if (
+    SFG_elementActivation(
+      e.coords[0] * RCL_UNITS_PER_SQUARE + RCL_UNITS_PER_SQUARE / 2,
+      e.coords[1] * RCL_UNITS_PER_SQUARE + RCL_UNITS_PER_SQUARE / 2,
+      e.coords[0],e.coords[1],&margin)
+    )
+    item |= SFG_ITEM_RECORD_ACTIVE_MASK;
+
+  SFG_currentLevel.itemRecords[index] = item;
+
+  return margin;
+}
+
+/**
+  Activates a monster if it's close enough to the player, deactivates it
+  otherwise. Returns the margin of SFG_elementActivation.
+*/
+RCL_Unit SFG_updateMonsterActivation(uint8_t index)
+{
+  SFG_MonsterRecord *monster = &(SFG_currentLevel.monsterRecords[index]);
+
+  RCL_Unit margin;
+
+  if ( // far away from the player?
+    !SFG_elementActivation(
+      SFG_MONSTER_COORD_TO_RCL_UNITS(monster->coords[0]),
+      SFG_MONSTER_COORD_TO_RCL_UNITS(monster->coords[1]),
+      SFG_MONSTER_COORD_TO_SQUARES(monster->coords[0]),
+      SFG_MONSTER_COORD_TO_SQUARES(monster->coords[1]),&margin)
+    )
+  {
+    monster->stateType = 
+       (monster->stateType & SFG_MONSTER_MASK_TYPE) |
+       SFG_MONSTER_STATE_INACTIVE;
+
+    SFG_currentLevel.activeMonsters &= ~(((uint64_t) 1) << index);
+  }
+  else if (SFG_MR_STATE(*monster) == SFG_MONSTER_STATE_INACTIVE)
+  {
+    monster->stateType = 
+      (monster->stateType & SFG_MONSTER_MASK_TYPE) |
+      (monster->health != 0 ? 
+        SFG_MONSTER_STATE_IDLE : SFG_MONSTER_STATE_DEAD);
+
+    SFG_currentLevel.activeMonsters |= ((uint64_t) 1) << index;
+  }
+
+  return margin;
+}
+
+/**
+  Returns the taxicab distance of the player from where all items and monsters
+  were last (de)activated.
+*/
+static inline RCL_Unit SFG_distanceFromActivation()
+{
+  return SFG_taxicabDistance(
+    SFG_player.camera.position.x,SFG_player.camera.position.y,
+    SFG_player.camera.height,SFG_currentLevel.activationPosition[0],
+    SFG_currentLevel.activationPosition[1],
+    SFG_currentLevel.activationPosition[2]);
+}
+
+/**
+  Converts a margin returned by SFG_elementActivation to a margin from
+  SFG_currentLevel.activationPosition, given the player's distance from it.
+*/
+static inline uint16_t SFG_activationMarginFrom(RCL_Unit margin,
+  RCL_Unit distance)
+{
+  return RCL_max(0,RCL_min(0xffff,margin - distance));
+}
+
+/**
+  Opens or closes given door depending on whether the player is next to it
+  (and has the card if the door is locked).
+*/
+void SFG_updateDoorActivation(SFG_DoorRecord *door)
+{
+  uint8_t upDownState = door->state & SFG_DOOR_UP_DOWN_MASK;
+
+  uint8_t newUpDownState = 0;
+  
+  uint8_t lock = SFG_DOOR_LOCK(door->state);
+
+  if ( // player near door?
+    (door->coords[0] >= (SFG_player.squarePosition[0] - 1)) &&
+    (door->coords[0] <= (SFG_player.squarePosition[0] + 1)) &&
+    (door->coords[1] >= (SFG_player.squarePosition[1] - 1)) &&
+    (door->coords[1] <= (SFG_player.squarePosition[1] + 1)))
+  {
+    if (lock == 0)
+    {
+      newUpDownState = SFG_DOOR_UP_DOWN_MASK;    
+    }
+    else
+    {
+      lock = 1 << (lock - 1);
+
+      if (SFG_player.cards & lock) // player has the card?
+        newUpDownState = SFG_DOOR_UP_DOWN_MASK;
+      else
+        SFG_player.cards = 
+          (SFG_player.cards & 0x07) | (lock << 3) | (2 << 6);
+    }
+  }
+
+  if (upDownState != newUpDownState)
+    SFG_playGameSound(1,255);
+
+  door->state = (door->state & ~SFG_DOOR_UP_DOWN_MASK) | newUpDownState;
+}
+
+/**
+  Activates level elements near the player and deactivates the others. Only
+  doors next to the player can open, so only those (and those next to the
+  square the player has left) are checked each frame. An item or monster is
+  only checked when the player has moved far enough for its activation to
+  possibly change (see SFG_currentLevel.activationMargin), and a monster also
+  when it moves itself.
+*/
+void SFG_updateActivation()
+{
+  int8_t *square = SFG_player.squarePosition;
+  int8_t *previous = SFG_currentLevel.activationSquare;
+
+  uint8_t squareChanged =
+    (square[0] != previous[0]) || (square[1] != previous[1]);
+
+  if (SFG_currentLevel.doorRecordCount > 0)
+  {
+    /* Count down the locked card blinking at the pace of the round-robin
+       door checks this replaces, once per all doors checked 8 at a time. */
+    if (SFG_currentLevel.cardBlinkDoorIndex == 0)
+    {
+      uint8_t count = SFG_player.cards >> 6;
+
+      SFG_player.cards = (count <= 1) ?
+        (SFG_player.cards & 0x07) :
+        ((SFG_player.cards & 0x7f) | ((count - 1) << 6));
+    }
+
+    SFG_currentLevel.cardBlinkDoorIndex =
+      (SFG_currentLevel.cardBlinkDoorIndex +
+      RCL_min(SFG_CARD_BLINK_DOORS_PER_FRAME,
+        SFG_currentLevel.doorRecordCount)) % SFG_currentLevel.doorRecordCount;
+  }
+
+  for (int8_t j = -1; j <= 1; ++j)
+    for (int8_t i = -1; i <= 1; ++i)
+    {
+      SFG_DoorRecord *door;
+
+      if (squareChanged) // close the doors the player has left
+      {
+        door = SFG_getDoorAt(previous[0] + i,previous[1] + j);
 
-void SFG_explodeBarrel(uint8_t itemIndex, RCL_Unit x, RCL_Unit y, RCL_Unit z)
-{
-  const SFG_LevelElement *e = SFG_getLevelElement(itemIndex);
-  SFG_setItemCollisionMapBit(e->coords[0],e->coords[1],0);
-  SFG_removeItem(itemIndex);
-  SFG_createExplosion(x,y,z);
-}
+        if (door != 0)
+          SFG_updateDoorActivation(door);
+      }
 
-void SFG_createExplosion(RCL_Unit x, RCL_Unit y, RCL_Unit z)
-{
-  SFG_ProjectileRecord explosion;
+      door = SFG_getDoorAt(square[0] + i,square[1] + j);
 
-  SFG_playGameSound(2,SFG_distantSoundVolume(x,y,z));
-  SFG_processEvent(SFG_EVENT_EXPLOSION,0);
+      if (door != 0)
+        SFG_updateDoorActivation(door);
+    }
 
-  explosion.type = SFG_PROJECTILE_EXPLOSION;
+  previous[0] = square[0];
+  previous[1] = square[1];
 
-  explosion.position[0] = x;
-  explosion.position[1] = y;
-  explosion.position[2] = z;
+  RCL_Unit moved = SFG_distanceFromActivation();
 
-  explosion.direction[0] = 0;
-  explosion.direction[1] = 0;
-  explosion.direction[2] = 0;
+  if (moved < SFG_currentLevel.activationMargin)
+    return;
 
-  explosion.doubleFramesToLive = RCL_nonZero(
-    SFG_GET_PROJECTILE_FRAMES_TO_LIVE(SFG_PROJECTILE_EXPLOSION) / 2);
+  /* Check the elements whose margin the player has used up. Each margin is
+     from activationPosition, so they shrink as the player gets farther from
+     it, and from some distance all are checked again from the new position
+     instead. */
 
-  SFG_createProjectile(explosion);
+  uint8_t all = moved >= SFG_ACTIVATION_RESET_DISTANCE;
 
-  uint8_t damage = SFG_getDamageValue(SFG_WEAPON_FIRE_TYPE_FIREBALL);
+  if (all)
+  {
+    SFG_currentLevel.activationPosition[0] = SFG_player.camera.position.x;
+    SFG_currentLevel.activationPosition[1] = SFG_player.camera.position.y;
+    SFG_currentLevel.activationPosition[2] = SFG_player.camera.height;
+    moved = 0;
+  }
 
-  if (SFG_taxicabDistance(x,y,z,SFG_player.camera.position.x,
-    SFG_player.camera.position.y,SFG_player.camera.height)
-    <= SFG_EXPLOSION_RADIUS)
+  RCL_Unit margin = RCL_INFINITY;
+
+  for (uint8_t i = 0; i < SFG_currentLevel.itemRecordCount; ++i)
   {
-    SFG_playerChangeHealth(-1 * damage);
-    SFG_pushPlayerAway(x,y,SFG_EXPLOSION_PUSH_AWAY_DISTANCE);
+    uint16_t *m = SFG_currentLevel.itemActivationMargins + i;
+
+    if (all || *m <= moved)
+      *m = SFG_activationMarginFrom(SFG_updateItemActivation(i),moved);
+
+    margin = RCL_min(margin,*m);
   }
 
-  for (uint16_t i = 0; i < SFG_currentLevel.monsterRecordCount; ++i)
+  for (uint8_t i = 0; i < SFG_currentLevel.monsterRecordCount; ++i)
   {
-    SFG_MonsterRecord *monster = &(SFG_currentLevel.monsterRecords[i]);
+    uint16_t *m = SFG_currentLevel.monsterActivationMargins + i;
 
-    uint16_t state = SFG_MR_STATE(*monster); 
+    if (all || *m <= moved)
+      *m = SFG_activationMarginFrom(SFG_updateMonsterActivation(i),moved);
 
-    if ((state == SFG_MONSTER_STATE_INACTIVE) ||
-        (state == SFG_MONSTER_STATE_DEAD))
-      continue; 
+    margin = RCL_min(margin,*m);
+  }
 
-    RCL_Unit monsterHeight =
-      SFG_floorHeightAt(
-        SFG_MONSTER_COORD_TO_SQUARES(monster->coords[0]),
-        SFG_MONSTER_COORD_TO_SQUARES(monster->coords[1]))
-        + RCL_UNITS_PER_SQUARE / 2;
+  SFG_currentLevel.activationMargin = margin;
+}
 
-    if (SFG_taxicabDistance(
-      SFG_MONSTER_COORD_TO_RCL_UNITS(monster->coords[0]),
-      SFG_MONSTER_COORD_TO_RCL_UNITS(monster->coords[1]),monsterHeight,
-      x,y,z) <= SFG_EXPLOSION_RADIUS)
+#if SFG_MONSTER_FLOW_FIELD
+/**
+  Gets the range of floor (collision) heights and the ceiling height a walking
+  monster may find in given square. Doors and squeezers count as fully open or
+  up as long as SFG_flowOpen says they are open now, otherwise as blocked;
+  elevators go over their whole range.
+*/
+static inline void SFG_flowHeightsAt(uint8_t x, uint8_t y, RCL_Unit *floor,
+  RCL_Unit *floorTop, RCL_Unit *ceiling)
+{
+  uint8_t properties;
+
+  SFG_TileDefinition tile =
+    SFG_getMapTile(SFG_currentLevel.levelPointer,x,y,&properties);
+
+  *floor = SFG_TILE_FLOOR_HEIGHT(tile) * SFG_WALL_HEIGHT_STEP +
+    SFG_getItemCollisionMapBit(x,y) * RCL_UNITS_PER_SQUARE;
+
+  *floorTop = *floor;
+  *ceiling = SFG_CEILING_MAX_HEIGHT;
+
+  if (properties == SFG_TILE_PROPERTY_ELEVATOR)
+    *floorTop += SFG_TILE_CEILING_HEIGHT(tile) * SFG_WALL_HEIGHT_STEP;
+  else if (properties != SFG_TILE_PROPERTY_SQUEEZER)
+  {
+    *ceiling = SFG_ceilingHeightAt(x,y);
+
+    if (properties == SFG_TILE_PROPERTY_DOOR && SFG_getDoorAt(x,y) != 0)
     {
-      SFG_monsterChangeHealth(monster,
-        -1 * SFG_getDamageValue(SFG_WEAPON_FIRE_TYPE_FIREBALL));
+      *floor -= RCL_UNITS_PER_SQUARE;
+      *floorTop = *floor;
     }
   }
 
-  // explode nearby barrels
+  if (properties != SFG_TILE_PROPERTY_ELEVATOR &&
+    (SFG_currentLevel.floorCeilingGrid[y * SFG_MAP_SIZE + x] &
+    SFG_MOVING_SQUARE) && !SFG_flowOpen(SFG_floorCeilingAt(x,y)))
+    *ceiling = *floor; // closed, no clearance until it opens
+}
 
-  if (damage >= SFG_BARREL_EXPLOSION_DAMAGE_THRESHOLD)
-    for (uint16_t i = 0; i < SFG_currentLevel.itemRecordCount; ++i)
-    {
-      SFG_ItemRecord item = SFG_currentLevel.itemRecords[i];
+/**
+  Recomputes the flow field for given player square by a breadth first search
+  from it, using the same step and clearance limits as monster movement.
+*/
+void SFG_updateFlowField(uint8_t x, uint8_t y)
+{
+  for (uint16_t i = 0; i < SFG_MAP_SIZE * SFG_MAP_SIZE; ++i)
+    SFG_currentLevel.flowField[i] = SFG_FLOW_UNREACHABLE;
 
-      /* We DON'T check just active barrels but all, otherwise it looks weird
-         that out of sight barrels in a line didn't explode.*/
+  SFG_currentLevel.flowSquare[0] = x;
+  SFG_currentLevel.flowSquare[1] = y;
 
-      SFG_LevelElement element = SFG_ITEM_RECORD_LEVEL_ELEMENT(item);
+  uint16_t index = y * SFG_MAP_SIZE + x;
+  uint16_t last = index;              // end of the queue
 
-      if (element.type != SFG_LEVEL_ELEMENT_BARREL)
-        continue;
+  SFG_currentLevel.flowField[index] = 0;
+  SFG_game.squareLinks[index] = SFG_NO_SQUARE;
 
-      RCL_Unit elementX =
-        element.coords[0] * RCL_UNITS_PER_SQUARE + RCL_UNITS_PER_SQUARE / 2;
+  while (index != SFG_NO_SQUARE)
+  {
+    x = index % SFG_MAP_SIZE;
+    y = index / SFG_MAP_SIZE;
 
-      RCL_Unit elementY =
-        element.coords[1] * RCL_UNITS_PER_SQUARE + RCL_UNITS_PER_SQUARE / 2;
+    uint8_t distance = SFG_currentLevel.flowField[index];
 
-      RCL_Unit elementHeight =
-        SFG_floorHeightAt(element.coords[0],element.coords[1]);
+    if (distance < SFG_FLOW_UNREACHABLE - 1)
+    {
+      RCL_Unit floor, floorTop, ceiling;
 
-      if (SFG_taxicabDistance(
-        x,y,z,elementX,elementY,elementHeight) <= SFG_EXPLOSION_RADIUS)
+      SFG_flowHeightsAt(x,y,&floor,&floorTop,&ceiling);
+
+      for (uint8_t i = 0; i < 4; ++i)
       {
-        SFG_explodeBarrel(i,elementX,elementY,elementHeight);
-        i--;
-      }
-    }
-}
+        int8_t nx = x + (i == 0) - (i == 1);
+        int8_t ny = y + (i == 2) - (i == 3);
 
-void SFG_createDust(RCL_Unit x, RCL_Unit y, RCL_Unit z)
-{
-  SFG_ProjectileRecord dust;
+        if (nx < 0 || ny < 0 || nx >= SFG_MAP_SIZE || ny >= SFG_MAP_SIZE)
+          continue;
 
-  dust.type = SFG_PROJECTILE_DUST;
+        uint16_t neighbor = ny * SFG_MAP_SIZE + nx;
 
-  dust.position[0] = x;
-  dust.position[1] = y;
-  dust.position[2] = z;
+        if (SFG_currentLevel.flowField[neighbor] != SFG_FLOW_UNREACHABLE)
+          continue; // already reached, always first at its lowest distance
 
-  dust.direction[0] = 0;
-  dust.direction[1] = 0;
-  dust.direction[2] = 0;
+        RCL_Unit neighborFloor, neighborFloorTop, neighborCeiling;
 
-  dust.doubleFramesToLive =
-    RCL_nonZero(SFG_GET_PROJECTILE_FRAMES_TO_LIVE(SFG_PROJECTILE_DUST) / 2);
+        SFG_flowHeightsAt(nx,ny,&neighborFloor,&neighborFloorTop,
+          &neighborCeiling);
 
-  SFG_createProjectile(dust);
+        if (neighborFloor - floorTop > RCL_CAMERA_COLL_STEP_HEIGHT ||
+          floor - neighborFloorTop > RCL_CAMERA_COLL_STEP_HEIGHT ||
+          neighborCeiling - neighborFloor < SFG_MONSTER_COLLISION_HEIGHT)
+          continue;
+
+        SFG_currentLevel.flowField[neighbor] = distance + 1;
+        SFG_game.squareLinks[neighbor] = SFG_NO_SQUARE;
+        SFG_game.squareLinks[last] = neighbor;
+        last = neighbor;
+      }
+    }
+
+    index = SFG_game.squareLinks[index];
+  }
 }
 
-void SFG_getMonsterWorldPosition(SFG_MonsterRecord *monster, RCL_Unit *x,
-  RCL_Unit *y, RCL_Unit *z)
+/**
+  Makes sure the flow field is computed for the square the player is in.
+*/
+static inline void SFG_updatePlayerFlowField()
 {
-  *x = SFG_MONSTER_COORD_TO_RCL_UNITS(monster->coords[0]);
-  *y = SFG_MONSTER_COORD_TO_RCL_UNITS(monster->coords[1]);
-  *z = SFG_floorHeightAt(
-         SFG_MONSTER_COORD_TO_SQUARES(monster->coords[0]),
-         SFG_MONSTER_COORD_TO_SQUARES(monster->coords[1]))
-       + RCL_UNITS_PER_SQUARE / 2;
+  if (SFG_player.squarePosition[0] != SFG_currentLevel.flowSquare[0] ||
+    SFG_player.squarePosition[1] != SFG_currentLevel.flowSquare[1])
+    SFG_updateFlowField(
+      SFG_player.squarePosition[0],SFG_player.squarePosition[1]);
+}
+
+/**
+  Gets the flow field value of given square, SFG_FLOW_UNREACHABLE outside the
+  map.
+*/
+static inline uint8_t SFG_flowFieldAt(int16_t x, int16_t y)
+{
+  return (((uint16_t) x) < SFG_MAP_SIZE && ((uint16_t) y) < SFG_MAP_SIZE) ?
+    SFG_currentLevel.flowField[y * SFG_MAP_SIZE + x] : SFG_FLOW_UNREACHABLE;
 }
+#endif
 
 void SFG_monsterPerformAI(SFG_MonsterRecord *monster)
 {
@@ -2396,29 +4149,80 @@ void SFG_monsterPerformAI(SFG_MonsterRecord *monster)
       {
         // walk towards player
 
-        if (monsterSquare[0] > SFG_player.squarePosition[0])
+        int8_t step[2]; // square offset to go to
+
+        step[0] = (monsterSquare[0] < SFG_player.squarePosition[0]) -
+          (monsterSquare[0] > SFG_player.squarePosition[0]);
+        step[1] = (monsterSquare[1] < SFG_player.squarePosition[1]) -
+          (monsterSquare[1] > SFG_player.squarePosition[1]);
+
+#if SFG_MONSTER_FLOW_FIELD
+        SFG_updatePlayerFlowField();
+
+        uint8_t distance = SFG_flowFieldAt(monsterSquare[0],monsterSquare[1]);
+
+        if (distance != 0 && distance != SFG_FLOW_UNREACHABLE)
         {
-          if (monsterSquare[1] > SFG_player.squarePosition[1])
+          /* Go to the neighbor nearest to the player by the flow field
+             (diagonally only if both squares on the sides are nearer too so
+             that no corner is cut), preferring the straight direction. */
+
+          int16_t best = 32767;
+          int8_t straight[2];
+
+          straight[0] = step[0];
+          straight[1] = step[1];
+
+          for (int8_t j = -1; j <= 1; ++j)
+            for (int8_t i = -1; i <= 1; ++i)
+            {
+              uint8_t value =
+                SFG_flowFieldAt(monsterSquare[0] + i,monsterSquare[1] + j);
+
+              if (value >= distance ||
+                (i != 0 && j != 0 &&
+                (SFG_flowFieldAt(monsterSquare[0] + i,monsterSquare[1])
+                  >= distance ||
+                 SFG_flowFieldAt(monsterSquare[0],monsterSquare[1] + j)
+                  >= distance)))
+                continue;
+
+              int16_t score = 4 * (value - distance) -
+                (i == straight[0]) - (j == straight[1]);
+
+              if (score < best)
+              {
+                best = score;
+                step[0] = i;
+                step[1] = j;
+              }
+            }
+        }
+#endif
+
+        if (step[0] < 0)
+        {
+          if (step[1] < 0)
             state = SFG_MONSTER_STATE_GOING_NW;
-          else if (monsterSquare[1] < SFG_player.squarePosition[1])
+          else if (step[1] > 0)
             state = SFG_MONSTER_STATE_GOING_SW;
           else
             state = SFG_MONSTER_STATE_GOING_W;
         }
-        else if (monsterSquare[0] < SFG_player.squarePosition[0])
+        else if (step[0] > 0)
         {
-          if (monsterSquare[1] > SFG_player.squarePosition[1])
+          if (step[1] < 0)
             state = SFG_MONSTER_STATE_GOING_NE;
-          else if (monsterSquare[1] < SFG_player.squarePosition[1])
+          else if (step[1] > 0)
             state = SFG_MONSTER_STATE_GOING_SE;
           else
             state = SFG_MONSTER_STATE_GOING_E;
         }
         else
         {
-          if (monsterSquare[1] > SFG_player.squarePosition[1])
+          if (step[1] < 0)
             state = SFG_MONSTER_STATE_GOING_N;
-          else if (monsterSquare[1] < SFG_player.squarePosition[1])
+          else if (step[1] > 0)
             state = SFG_MONSTER_STATE_GOING_S;
         }
       }
@@ -2558,8 +4362,41 @@ void SFG_monsterPerformAI(SFG_MonsterRecord *monster)
   }
 
   monster->stateType = state | (monsterNumber << 4);
+
+  uint8_t moved =
+    newPos[0] != monster->coords[0] || newPos[1] != monster->coords[1];
+
+#if SFG_MONSTER_GRID
+  uint8_t gridIndex = SFG_monsterGridIndex(monster->coords);
+#endif
+
   monster->coords[0] = newPos[0];
   monster->coords[1] = newPos[1];;
+
+#if SFG_MONSTER_GRID
+  uint8_t newGridIndex = SFG_monsterGridIndex(monster->coords);
+
+  if (newGridIndex != gridIndex)
+  {
+    uint64_t bit =
+      ((uint64_t) 1) << (monster - SFG_currentLevel.monsterRecords);
+
+    SFG_currentLevel.monsterGrid[gridIndex] &= ~bit;
+    SFG_currentLevel.monsterGrid[newGridIndex] |= bit;
+  }
+#endif
+
+  if (moved) // may have walked out of the active distance
+  {
+    uint8_t index = monster - SFG_currentLevel.monsterRecords;
+
+    uint16_t margin = SFG_activationMarginFrom(
+      SFG_updateMonsterActivation(index),SFG_distanceFromActivation());
+
+    SFG_currentLevel.monsterActivationMargins[index] = margin;
+    SFG_currentLevel.activationMargin =
+      RCL_min(SFG_currentLevel.activationMargin,margin);
+  }
 }
 
 static inline uint8_t SFG_elementCollides(
@@ -2577,17 +4414,22 @@ static inline uint8_t SFG_elementCollides(
 }
 
 /**
-  Checks collision of a projectile with level element at given position.
+  Checks collision of a projectile (given by index) with level element at
+  given position.
 */
-uint8_t SFG_projectileCollides(SFG_ProjectileRecord *projectile,
+uint8_t SFG_projectileCollides(uint8_t projectile,
   RCL_Unit x, RCL_Unit y, RCL_Unit z)
 {
-  if (!SFG_elementCollides(x,y,z,
-    projectile->position[0],projectile->position[1],projectile->position[2]))
+  RCL_Unit projectileX = SFG_currentLevel.projectilePositions[0][projectile];
+  RCL_Unit projectileY = SFG_currentLevel.projectilePositions[1][projectile];
+
+  if (!SFG_elementCollides(x,y,z,projectileX,projectileY,
+    SFG_currentLevel.projectilePositions[2][projectile]))
     return 0;
 
-  if ((projectile->type == SFG_PROJECTILE_EXPLOSION) ||
-      (projectile->type == SFG_PROJECTILE_DUST))
+  uint8_t type = SFG_currentLevel.projectileTypes[projectile];
+
+  if ((type == SFG_PROJECTILE_EXPLOSION) || (type == SFG_PROJECTILE_DUST))
     return 0;
 
   /* For directional projectiles we only register a collision if its direction
@@ -2596,15 +4438,59 @@ uint8_t SFG_projectileCollides(SFG_ProjectileRecord *projectile,
 
   RCL_Vector2D projDir, toElement;
 
-  projDir.x = projectile->direction[0]; 
-  projDir.y = projectile->direction[1];
+  projDir.x = SFG_currentLevel.projectileDirections[0][projectile]; 
+  projDir.y = SFG_currentLevel.projectileDirections[1][projectile];
 
-  toElement.x = x - projectile->position[0];
-  toElement.y = y - projectile->position[1];
+  toElement.x = x - projectileX;
+  toElement.y = y - projectileY;
    
   return RCL_vectorsAngleCos(projDir,toElement) >= 0;
 }
 
+#define SFG_PROJECTILE_FLIES 0   ///< SFG_cullProjectile: keeps flying.
+#define SFG_PROJECTILE_STOPS 1   ///< SFG_cullProjectile: hits map or leaves it.
+#define SFG_PROJECTILE_EXPIRES 2 ///< SFG_cullProjectile: no more time to live.
+
+/**
+  Checks whether a projectile's (given by index) next step leaves the map or
+  collides with it and whether its time is up, returns one of
+  SFG_PROJECTILE_FLIES, SFG_PROJECTILE_STOPS and SFG_PROJECTILE_EXPIRES.
+  Collisions with the player and level elements are checked separately.
+*/
+static inline uint8_t SFG_cullProjectile(uint8_t projectile)
+{
+  if (SFG_currentLevel.projectileDoubleFramesToLive[projectile] == 0)
+    return SFG_PROJECTILE_EXPIRES;
+
+  RCL_Unit pos[3]; /* we have to convert from uint16_t because of
+                      under/overflows */
+
+  for (uint8_t j = 0; j < 3; ++j)
+  {
+    pos[j] = SFG_currentLevel.projectilePositions[j][projectile];
+    pos[j] += SFG_currentLevel.projectileDirections[j][projectile];
+
+    if (((uint32_t) pos[j]) >= SFG_MAP_SIZE * RCL_UNITS_PER_SQUARE)
+      return SFG_PROJECTILE_STOPS; // outside map
+  }
+
+  uint8_t type = SFG_currentLevel.projectileTypes[projectile];
+
+  if ((type == SFG_PROJECTILE_EXPLOSION) || (type == SFG_PROJECTILE_DUST))
+    return SFG_PROJECTILE_FLIES;
+
+  /* Check collision with the map (we don't use SFG_floorCollisionHeightAt
+     because collisions with items have to be done differently for
+     projectiles), the square is inside the map here. */
+
+  RCL_Unit floorCeiling = SFG_floorCeilingAt(
+    pos[0] / RCL_UNITS_PER_SQUARE,pos[1] / RCL_UNITS_PER_SQUARE);
+
+  return (((int16_t) (floorCeiling >> 16)) >= pos[2] ||
+    ((int16_t) (floorCeiling & 0x0000ffff)) <= pos[2]) ?
+    SFG_PROJECTILE_STOPS : SFG_PROJECTILE_FLIES;
+}
+
 /**
   Updates a frame of the currently loaded level, i.e. enemies, projectiles,
   animations etc., with the exception of player.
@@ -2618,45 +4504,42 @@ void SFG_updateLevel()
     /* ^ only substract frames to live every other frame because a maximum of
        256 frames would be too few */
 
-  for (int8_t i = 0; i < SFG_currentLevel.projectileRecordCount; ++i)
-  { // ^ has to be signed
-    SFG_ProjectileRecord *p = &(SFG_currentLevel.projectileRecords[i]);
+  uint8_t culledCount = SFG_currentLevel.projectileRecordCount;
+  uint8_t cull[SFG_MAX_PROJECTILES];
+
+  for (uint8_t i = 0; i < culledCount; ++i) // first check all against the map
+    cull[i] = SFG_cullProjectile(i);
 
+  uint8_t i = 0;
+
+  while (i < SFG_currentLevel.projectileRecordCount)
+  { /* ^ the count can grow as explosions and dust are added, these are
+         checked against the map here */
+    uint8_t type = SFG_currentLevel.projectileTypes[i];
     uint8_t attackType = 255;
 
-    if (p->type == SFG_PROJECTILE_BULLET)
+    // projectiles are only moved after this loop, so the position holds
+    RCL_Unit position[3];
+
+    for (uint8_t j = 0; j < 3; ++j)
+      position[j] = SFG_currentLevel.projectilePositions[j][i];
+
+    if (type == SFG_PROJECTILE_BULLET)
       attackType = SFG_WEAPON_FIRE_TYPE_BULLET;
-    else if (p->type == SFG_PROJECTILE_PLASMA)
+    else if (type == SFG_PROJECTILE_PLASMA)
       attackType = SFG_WEAPON_FIRE_TYPE_PLASMA;
 
-    RCL_Unit pos[3] = {0,0,0}; /* we have to convert from uint16_t because of
-                                  under/overflows */
-    uint8_t eliminate = 0;
+    uint8_t projectileCull = (i < culledCount) ?
+      cull[i] : SFG_cullProjectile(i);
 
-    for (uint8_t j = 0; j < 3; ++j) 
-    {
-      pos[j] = p->position[j];
-      pos[j] += p->direction[j];
-
-      if ( // projectile outside map?
-        (pos[j] < 0) ||
-        (pos[j] >= (SFG_MAP_SIZE * RCL_UNITS_PER_SQUARE)))
-      {
-        eliminate = 1;
-        break;
-      }
-    }
+    uint8_t eliminate = projectileCull != SFG_PROJECTILE_FLIES;
 
-    if (p->doubleFramesToLive == 0) // no more time to live?
-    {
-      eliminate = 1;
-    }
-    else if (
-      (p->type != SFG_PROJECTILE_EXPLOSION) &&
-      (p->type != SFG_PROJECTILE_DUST))
+    if (projectileCull != SFG_PROJECTILE_EXPIRES &&
+      (type != SFG_PROJECTILE_EXPLOSION) &&
+      (type != SFG_PROJECTILE_DUST))
     {
       if (SFG_projectileCollides( // collides with player?
-            p,
+            i,
             SFG_player.camera.position.x,
             SFG_player.camera.position.y,
             SFG_player.camera.height))
@@ -2666,23 +4549,18 @@ void SFG_updateLevel()
           SFG_playerChangeHealth(-1 * SFG_getDamageValue(attackType));
         }
 
-      /* Check collision with the map (we don't use SFG_floorCollisionHeightAt
-         because collisions with items have to be done differently for
-         projectiles). */
-
-      if (!eliminate &&
-          ((SFG_floorHeightAt(pos[0] / RCL_UNITS_PER_SQUARE,pos[1] / 
-            RCL_UNITS_PER_SQUARE) >= pos[2])
-          ||
-          (SFG_ceilingHeightAt(pos[0] / RCL_UNITS_PER_SQUARE,pos[1] /
-            RCL_UNITS_PER_SQUARE) <= pos[2]))
-        )
-        eliminate = 1;
-
       // check collision with active level elements
 
-      if (!eliminate) // monsters 
-        for (uint16_t j = 0; j < SFG_currentLevel.monsterRecordCount; ++j)
+#if SFG_MONSTER_GRID
+      uint64_t monsters = eliminate ? 0 : 
+        (SFG_monstersNear(position[0],position[1],
+          SFG_ELEMENT_COLLISION_RADIUS) & SFG_currentLevel.activeMonsters);
+#else
+      uint64_t monsters = eliminate ? 0 : SFG_currentLevel.activeMonsters;
+#endif
+
+      for (uint16_t j = 0; monsters != 0; ++j, monsters >>= 1) // monsters
+        if (monsters & 0x01)
         {
           SFG_MonsterRecord *m = &(SFG_currentLevel.monsterRecords[j]);
 
@@ -2691,7 +4569,7 @@ void SFG_updateLevel()
           if ((state != SFG_MONSTER_STATE_INACTIVE) &&
               (state != SFG_MONSTER_STATE_DEAD))
           {
-            if (SFG_projectileCollides(p,
+            if (SFG_projectileCollides(i,
                   SFG_MONSTER_COORD_TO_RCL_UNITS(m->coords[0]),
                   SFG_MONSTER_COORD_TO_RCL_UNITS(m->coords[1]),
                   SFG_floorHeightAt(
@@ -2715,9 +4593,14 @@ void SFG_updateLevel()
           {
             RCL_Unit x = SFG_ELEMENT_COORD_TO_RCL_UNITS(e->coords[0]);
             RCL_Unit y = SFG_ELEMENT_COORD_TO_RCL_UNITS(e->coords[1]);
+
+            if (RCL_abs(x - position[0]) + RCL_abs(y - position[1]) >
+              SFG_ELEMENT_COLLISION_RADIUS)
+              continue; // too far already horizontally
+
             RCL_Unit z = SFG_floorHeightAt(e->coords[0],e->coords[1]);
 
-            if (SFG_projectileCollides(p,x,y,z))
+            if (SFG_projectileCollides(i,x,y,z))
             {
               if (
                    (e->type == SFG_LEVEL_ELEMENT_BARREL) &&
@@ -2725,208 +4608,87 @@ void SFG_updateLevel()
                      SFG_BARREL_EXPLOSION_DAMAGE_THRESHOLD)
                  )
               {
-                SFG_explodeBarrel(j,x,y,z);
-              }
-
-              eliminate = 1;
-              break;
-            }
-          }
-        }
-    }
-
-    if (eliminate)
-    {
-      if (p->type == SFG_PROJECTILE_FIREBALL)
-        SFG_createExplosion(p->position[0],p->position[1],p->position[2]);
-      else if (p->type == SFG_PROJECTILE_BULLET)
-        SFG_createDust(p->position[0],p->position[1],p->position[2]);
-      else if (p->type == SFG_PROJECTILE_PLASMA)
-        SFG_playGameSound(4,SFG_distantSoundVolume(pos[0],pos[1],pos[2]));
-
-      // remove the projectile
-
-      for (uint8_t j = i; j < SFG_currentLevel.projectileRecordCount - 1; ++j)
-        SFG_currentLevel.projectileRecords[j] =
-          SFG_currentLevel.projectileRecords[j + 1];
-
-      SFG_currentLevel.projectileRecordCount--;
-
-      i--;
-    }
-    else
-    {
-      p->position[0] = pos[0];
-      p->position[1] = pos[1];
-      p->position[2] = pos[2];
-    }
-
-    p->doubleFramesToLive -= substractFrames;
-  }
-
-  // handle door:
-  if (SFG_currentLevel.doorRecordCount > 0) // has to be here
-  {
-    /* Check door on whether a player is standing nearby. For performance
-       reasons we only check a few doors and move to others in the next
-       frame. */
-   
-    if (SFG_currentLevel.checkedDoorIndex == 0)
-    {
-      uint8_t count = SFG_player.cards >> 6;
-
-      SFG_player.cards = (count <= 1) ?
-        (SFG_player.cards & 0x07) :
-        ((SFG_player.cards & 0x7f) | ((count - 1) << 6));
-    }
- 
-    for (uint16_t i = 0;
-         i < RCL_min(SFG_ELEMENT_DISTANCES_CHECKED_PER_FRAME,
-           SFG_currentLevel.doorRecordCount);
-         ++i) 
-    {
-      SFG_DoorRecord *door =
-        &(SFG_currentLevel.doorRecords[SFG_currentLevel.checkedDoorIndex]);
-
-      uint8_t upDownState = door->state & SFG_DOOR_UP_DOWN_MASK;
-
-      uint8_t newUpDownState = 0;
-      
-      uint8_t lock = SFG_DOOR_LOCK(door->state);
-
-      if ( // player near door?
-        (door->coords[0] >= (SFG_player.squarePosition[0] - 1)) &&
-        (door->coords[0] <= (SFG_player.squarePosition[0] + 1)) &&
-        (door->coords[1] >= (SFG_player.squarePosition[1] - 1)) &&
-        (door->coords[1] <= (SFG_player.squarePosition[1] + 1)))
-      {
-        if (lock == 0)
-        {
-          newUpDownState = SFG_DOOR_UP_DOWN_MASK;    
-        }
-        else
-        {
-          lock = 1 << (lock - 1);
+                SFG_explodeBarrel(j,x,y,z);
+              }
 
-          if (SFG_player.cards & lock) // player has the card?
-            newUpDownState = SFG_DOOR_UP_DOWN_MASK;
-          else
-            SFG_player.cards = 
-              (SFG_player.cards & 0x07) | (lock << 3) | (2 << 6);
+              eliminate = 1;
+              break;
+            }
+          }
         }
-      }
-
-      if (upDownState != newUpDownState)
-        SFG_playGameSound(1,255);
-
-      door->state = (door->state & ~SFG_DOOR_UP_DOWN_MASK) | newUpDownState;
-
-      SFG_currentLevel.checkedDoorIndex++;
-
-      if (SFG_currentLevel.checkedDoorIndex >= SFG_currentLevel.doorRecordCount)
-        SFG_currentLevel.checkedDoorIndex = 0;
     }
 
-    // move door up/down:
-    for (uint32_t i = 0; i < SFG_currentLevel.doorRecordCount; ++i)
+    if (eliminate)
     {
-      SFG_DoorRecord *door = &(SFG_currentLevel.doorRecords[i]);
+      if (type == SFG_PROJECTILE_FIREBALL)
+        SFG_createExplosion(position[0],position[1],position[2]);
+      else if (type == SFG_PROJECTILE_BULLET)
+        SFG_createDust(position[0],position[1],position[2]);
+      else if (type == SFG_PROJECTILE_PLASMA)
+        SFG_playGameSound(4,SFG_distantSoundVolume(
+          position[0] + SFG_currentLevel.projectileDirections[0][i],
+          position[1] + SFG_currentLevel.projectileDirections[1][i],
+          position[2] + SFG_currentLevel.projectileDirections[2][i]));
+
+      // remove the projectile, right away so that its slot can be reused
 
-      int8_t height = door->state & SFG_DOOR_VERTICAL_POSITION_MASK;
+      SFG_removeProjectile(i);
 
-      height = (door->state & SFG_DOOR_UP_DOWN_MASK) ?
-            RCL_min(0x1f,height + SFG_DOOR_INCREMENT_PER_FRAME) :
-            RCL_max(0x00,height - SFG_DOOR_INCREMENT_PER_FRAME);
+      if (i < culledCount)
+      {
+        culledCount--;
 
-      door->state = (door->state & ~SFG_DOOR_VERTICAL_POSITION_MASK) | height;
+        for (uint8_t j = i; j < culledCount; ++j)
+          cull[j] = cull[j + 1];
+      }
     }
+    else
+      i++;
   }
 
-  // handle items, in a similar manner to door:
-  if (SFG_currentLevel.itemRecordCount > 0) // has to be here
-  {
-    // check item distances:
-
-    for (uint16_t i = 0;
-         i < RCL_min(SFG_ELEMENT_DISTANCES_CHECKED_PER_FRAME,
-           SFG_currentLevel.itemRecordCount);
-         ++i) 
-    {
-      SFG_ItemRecord item =
-        SFG_currentLevel.itemRecords[SFG_currentLevel.checkedItemIndex];
-
-      item &= ~SFG_ITEM_RECORD_ACTIVE_MASK;
-
-      SFG_LevelElement e =
-        SFG_currentLevel.levelPointer->elements[item];
-
-      if (
-        SFG_isInActiveDistanceFromPlayer(
-          e.coords[0] * RCL_UNITS_PER_SQUARE + RCL_UNITS_PER_SQUARE / 2,
-          e.coords[1] * RCL_UNITS_PER_SQUARE + RCL_UNITS_PER_SQUARE / 2,
-          SFG_floorHeightAt(e.coords[0],e.coords[1]) + RCL_UNITS_PER_SQUARE / 2)
-        )
-        item |= SFG_ITEM_RECORD_ACTIVE_MASK;
+  // move the projectiles that are left, all in one loop:
 
-      SFG_currentLevel.itemRecords[SFG_currentLevel.checkedItemIndex] = item;
-
-      SFG_currentLevel.checkedItemIndex++;
+  for (i = 0; i < SFG_currentLevel.projectileRecordCount; ++i)
+  {
+    for (uint8_t j = 0; j < 3; ++j)
+      SFG_currentLevel.projectilePositions[j][i] +=
+        SFG_currentLevel.projectileDirections[j][i];
 
-      if (SFG_currentLevel.checkedItemIndex >= SFG_currentLevel.itemRecordCount)
-        SFG_currentLevel.checkedItemIndex = 0;
-    }
+    SFG_currentLevel.projectileDoubleFramesToLive[i] -= substractFrames;
   }
 
-  // similarly handle monsters:
-  if (SFG_currentLevel.monsterRecordCount > 0) // has to be here
+  // (de)activate doors, items and monsters near the player:
+  SFG_updateActivation();
+
+  // move door up/down:
+  for (uint32_t i = 0; i < SFG_currentLevel.doorRecordCount; ++i)
   {
-    // check monster distances:
+    SFG_DoorRecord *door = &(SFG_currentLevel.doorRecords[i]);
 
-    for (uint16_t i = 0;
-         i < RCL_min(SFG_ELEMENT_DISTANCES_CHECKED_PER_FRAME,
-           SFG_currentLevel.monsterRecordCount);
-         ++i) 
-    {
-      SFG_MonsterRecord *monster =
-      &(SFG_currentLevel.monsterRecords[SFG_currentLevel.checkedMonsterIndex]);
+    int8_t height = door->state & SFG_DOOR_VERTICAL_POSITION_MASK;
 
-      if ( // far away from the player?
-        !SFG_isInActiveDistanceFromPlayer(
-          SFG_MONSTER_COORD_TO_RCL_UNITS(monster->coords[0]),
-          SFG_MONSTER_COORD_TO_RCL_UNITS(monster->coords[1]),
-          SFG_floorHeightAt(
-            SFG_MONSTER_COORD_TO_SQUARES(monster->coords[0]),
-            SFG_MONSTER_COORD_TO_SQUARES(monster->coords[1]))
-            + RCL_UNITS_PER_SQUARE / 2
-          )
-        )
-      {
-        monster->stateType = 
-           (monster->stateType & SFG_MONSTER_MASK_TYPE) |
-           SFG_MONSTER_STATE_INACTIVE;
-      }
-      else if (SFG_MR_STATE(*monster) == SFG_MONSTER_STATE_INACTIVE)
-      {
-        monster->stateType = 
-          (monster->stateType & SFG_MONSTER_MASK_TYPE) |
-          (monster->health != 0 ? 
-            SFG_MONSTER_STATE_IDLE : SFG_MONSTER_STATE_DEAD);
-      }
+    int8_t newHeight = (door->state & SFG_DOOR_UP_DOWN_MASK) ?
+          RCL_min(0x1f,height + SFG_DOOR_INCREMENT_PER_FRAME) :
+          RCL_max(0x00,height - SFG_DOOR_INCREMENT_PER_FRAME);
 
-      SFG_currentLevel.checkedMonsterIndex++;
+    door->state = (door->state & ~SFG_DOOR_VERTICAL_POSITION_MASK) |
+      newHeight;
 
-      if (SFG_currentLevel.checkedMonsterIndex >=
-        SFG_currentLevel.monsterRecordCount)
-        SFG_currentLevel.checkedMonsterIndex = 0;
-    }
+    if (newHeight != height)
+      SFG_updateSquareHeight(door->coords[0],door->coords[1]);
   }
 
   // update AI and handle dead monsters:
   if ((SFG_game.frame - SFG_currentLevel.frameStart) %
       SFG_AI_UPDATE_FRAME_INTERVAL == 0)
   {
-    for (uint16_t i = 0; i < SFG_currentLevel.monsterRecordCount; ++i)
+    uint64_t monsters = SFG_currentLevel.activeMonsters;
+
+    for (uint16_t i = 0; monsters != 0; ++i, monsters >>= 1)
     {
+      if (!(monsters & 0x01))
+        continue;
+
       SFG_MonsterRecord *monster = &(SFG_currentLevel.monsterRecords[i]);
       uint8_t state = SFG_MR_STATE(*monster);
 
@@ -3353,8 +5115,13 @@ void SFG_gameStepPlaying()
   // handle player collision with level elements:
 
   // monsters:
-  for (uint16_t i = 0; i < SFG_currentLevel.monsterRecordCount; ++i)
+  uint64_t monsters = SFG_currentLevel.activeMonsters;
+
+  for (uint16_t i = 0; monsters != 0; ++i, monsters >>= 1)
   {
+    if (!(monsters & 0x01))
+      continue;
+
     SFG_MonsterRecord *m = &(SFG_currentLevel.monsterRecords[i]);
 
     uint8_t state = SFG_MR_STATE(*m);
@@ -3660,8 +5427,13 @@ void SFG_gameStepPlaying()
       {
         // player's melee attack
 
-        for (uint16_t i = 0; i < SFG_currentLevel.monsterRecordCount; ++i)
+        uint64_t monsters = SFG_currentLevel.activeMonsters;
+
+        for (uint16_t i = 0; monsters != 0; ++i, monsters >>= 1)
         {
+          if (!(monsters & 0x01))
+            continue;
+
           SFG_MonsterRecord *m = &(SFG_currentLevel.monsterRecords[i]);
 
           uint8_t state = SFG_MR_STATE(*m);
@@ -3995,6 +5767,9 @@ void SFG_gameStep()
 {
   SFG_GAME_STEP_COMMAND
 
+  if (SFG_currentLevel.levelPointer != 0)
+    SFG_updateMovingWalls(); // time has moved
+
   SFG_game.soundsPlayedThisFrame = 0;
   
   SFG_game.blink = (SFG_game.frame / SFG_BLINK_PERIOD_FRAMES) % 2;
@@ -4688,12 +6463,394 @@ void SFG_drawWinOverlay()
   #undef INNER_STRIP_HEIGHT
 }
 
-void SFG_draw()
+/**
+  Renders given part (range of columns) of the 3D view that's being drawn by
+  SFG_draw(), see SFG_renderViewParallel().
+*/
+void SFG_renderViewPart(uint8_t part)
 {
-#if SFG_BACKGROUND_BLUR != 0
-  SFG_backgroundBlurIndex = 0;
+  int16_t width = SFG_player.camera.resolution.x;
+
+  RCL_renderComplexColumns(
+    (part * width) / SFG_RENDERING_THREADS,
+    ((part + 1) * width) / SFG_RENDERING_THREADS);
+}
+
+#if SFG_VIEW_REUSE
+static inline uint32_t SFG_viewKeyAdd(uint32_t key, uint32_t value)
+{
+  return (key ^ value) * 16777619; // FNV-1 prime
+}
+
+/**
+  Checks whether given square intersects the horizontal field of view whose
+  edges have given directions.
+*/
+static inline uint8_t SFG_squareInView(RCL_Vector2D left, RCL_Vector2D right,
+  uint8_t x, uint8_t y)
+{
+  uint8_t outsideLeft = 1, outsideRight = 1;
+
+  for (uint8_t i = 0; i < 4; ++i)
+  {
+    RCL_Unit cornerX = (x + (i & 0x01)) * RCL_UNITS_PER_SQUARE -
+      SFG_player.camera.position.x;
+    RCL_Unit cornerY = (y + (i >> 1)) * RCL_UNITS_PER_SQUARE -
+      SFG_player.camera.position.y;
+
+    if (left.x * cornerY - left.y * cornerX >= 0)
+      outsideLeft = 0;
+
+    if (right.x * cornerY - right.y * cornerX <= 0)
+      outsideRight = 0;
+  }
+
+  return !(outsideLeft || outsideRight);
+}
+
+/**
+  Computes a hash of everything that affects how the 3D view (including
+  sprites) looks, so that if it doesn't change, the previous view can be
+  reused.
+*/
+uint32_t SFG_viewKey()
+{
+  uint32_t key = 2166136261;
+
+  key = SFG_viewKeyAdd(key,SFG_game.worldEpoch);
+  key = SFG_viewKeyAdd(key,SFG_player.camera.position.x);
+  key = SFG_viewKeyAdd(key,SFG_player.camera.position.y);
+  key = SFG_viewKeyAdd(key,SFG_player.camera.direction);
+  key = SFG_viewKeyAdd(key,SFG_player.camera.height);
+  key = SFG_viewKeyAdd(key,SFG_player.camera.shear);
+#if SFG_QUALITY_GOVERNOR
+  key = SFG_viewKeyAdd(key,SFG_game.qualityLevel);
+#endif
+
+  /* The animation frame only matters if the view shows a monster, which
+     can't change without something else in the key changing. */
+  key = SFG_viewKeyAdd(key,
+    SFG_game.spriteAnimationFrame & SFG_game.viewAnimated);
+
+  uint64_t monsters = SFG_currentLevel.activeMonsters;
+
+  key = SFG_viewKeyAdd(key,(uint32_t) monsters);
+  key = SFG_viewKeyAdd(key,(uint32_t) (monsters >> 32));
+
+  // inactive monsters aren't drawn
+  for (uint8_t i = 0; monsters != 0; ++i, monsters >>= 1)
+  {
+    if (!(monsters & 0x01))
+      continue;
+
+    SFG_MonsterRecord *m = SFG_currentLevel.monsterRecords + i;
+
+    key = SFG_viewKeyAdd(key,m->stateType | (m->coords[0] << 8) |
+      (((uint32_t) m->coords[1]) << 16));
+  }
+
+  for (uint8_t i = 0; i < SFG_currentLevel.itemRecordCount; ++i)
+    key = SFG_viewKeyAdd(key,SFG_currentLevel.itemRecords[i]);
+
+  /* Of the squares whose height changes (doors, elevators and squeezers) only
+     those in the field of view that may be seen from the player's square
+     matter. */
+
+  RCL_Vector2D left =
+    RCL_angleToDirection(SFG_player.camera.direction - RCL_HORIZONTAL_FOV_HALF);
+  RCL_Vector2D right =
+    RCL_angleToDirection(SFG_player.camera.direction + RCL_HORIZONTAL_FOV_HALF);
+
+#if SFG_SIGHT_GRID
+  SFG_updatePlayerSightGrid();
+  #define SEEN(x,y) (SFG_squareInView(left,right,x,y) && \
+    SFG_currentLevel.sightGrid[(y) * SFG_MAP_SIZE + (x)] != SFG_SIGHT_BLOCKED)
+#else
+  #define SEEN(x,y) SFG_squareInView(left,right,x,y)
+#endif
+
+  for (uint8_t i = 0; i < SFG_currentLevel.movingWallCount; ++i)
+  {
+    uint8_t *coords = SFG_currentLevel.movingWalls[i];
+
+    if (SEEN(coords[0],coords[1]))
+      key = SFG_viewKeyAdd(key,
+        SFG_currentLevel.movingFloorCeilings[SFG_MAX_DOORS + i]);
+  }
+
+  for (uint8_t i = 0; i < SFG_currentLevel.doorRecordCount; ++i)
+  {
+    SFG_DoorRecord *door = SFG_currentLevel.doorRecords + i;
+
+    if (SEEN(door->coords[0],door->coords[1]))
+      key = SFG_viewKeyAdd(key,SFG_currentLevel.movingFloorCeilings[i]);
+  }
+
+  #undef SEEN
+
+  for (uint8_t i = 0; i < SFG_currentLevel.projectileRecordCount; ++i)
+  {
+    uint8_t type = SFG_currentLevel.projectileTypes[i];
+
+    if (type == SFG_PROJECTILE_BULLET)
+      continue; // bullets aren't drawn
+
+    key = SFG_viewKeyAdd(key,type |
+      (SFG_currentLevel.projectileDoubleFramesToLive[i] << 8) |
+      (((uint32_t) SFG_currentLevel.projectilePositions[2][i]) << 16));
+    key = SFG_viewKeyAdd(key,SFG_currentLevel.projectilePositions[0][i] |
+      (((uint32_t) SFG_currentLevel.projectilePositions[1][i]) << 16));
+  }
+
+  return key;
+}
+#endif
+
+/**
+  Adds a sprite to be drawn in the current frame, keeping the list sorted by
+  depth from the nearest (there are few sprites in view, so insertion is
+  cheap).
+*/
+void SFG_addViewSprite(const uint8_t *image, int16_t x, int16_t y,
+  int16_t size, uint8_t minusValue, RCL_Unit depth)
+{
+  uint16_t i = SFG_game.viewSpriteCount;
+
+  if (i >= SFG_MAX_VIEW_SPRITES)
+    return;
+
+  while (i > 0 && SFG_game.viewSprites[i - 1].depth > depth)
+  {
+    SFG_game.viewSprites[i] = SFG_game.viewSprites[i - 1];
+    i--;
+  }
+
+  SFG_ViewSprite *sprite = &(SFG_game.viewSprites[i]);
+
+  sprite->image = image;
+  sprite->x = x;
+  sprite->y = y;
+  sprite->size = size;
+  sprite->minusValue = minusValue;
+  sprite->depth = depth;
+
+  SFG_game.viewSpriteCount++;
+}
+
+#if SFG_DEPTH_BUFFER
+  // sprites are tested against the depth buffer pixel by pixel, no rays needed
+  #define SFG_SPRITE_IN_VIEW(position,height) 1
+#else
+  #define SFG_SPRITE_IN_VIEW(position,height) \
+    SFG_spriteIsVisible(position,height)
+#endif
+
+/**
+  Draws the 3D view (walls, floors and sprites) for the current camera.
+*/
+void SFG_drawView()
+{
+  SFG_game.viewSpriteCount = 0;
+
+#if SFG_VIEW_REUSE
+  SFG_game.viewAnimated = 0;
 #endif
 
+#if SFG_CACHE_BACKGROUND
+  {
+    // same as scale map at ((x * subsample + scroll) % resolution y)
+    uint16_t position = SFG_game.backgroundScroll % SFG_GAME_RESOLUTION_Y;
+
+    for (uint16_t i = 0; i < SFG_GAME_RESOLUTION_X / SFG_VIEW_SUBSAMPLE; ++i)
+    {
+      SFG_game.backgroundColumnMap[i] = SFG_game.backgroundScaleMap[position];
+
+      position += SFG_VIEW_SUBSAMPLE;
+
+      while (position >= SFG_GAME_RESOLUTION_Y)
+        position -= SFG_GAME_RESOLUTION_Y;
+    }
+  }
+#endif
+
+#if SFG_RENDERING_THREADS > 1
+  RCL_renderComplexBegin(
+    SFG_player.camera,
+    SFG_floorHeightAt,
+    SFG_ceilingHeightAt,
+    SFG_texturesAt,
+    SFG_game.rayConstraints);
+
+  SFG_renderViewParallel(); // all parts are rendered after this returns
+#else
+  RCL_renderComplex(
+    SFG_player.camera,
+    SFG_floorHeightAt,
+    SFG_ceilingHeightAt,
+    SFG_texturesAt,
+    SFG_game.rayConstraints);
+#endif
+
+  // draw sprites:
+
+  // monster sprites:
+  uint64_t monsters = SFG_currentLevel.activeMonsters;
+
+  for (int_fast16_t i = 0; monsters != 0; ++i, monsters >>= 1)
+  {
+    if (!(monsters & 0x01))
+      continue;
+
+    SFG_MonsterRecord m = SFG_currentLevel.monsterRecords[i];
+    uint8_t state = SFG_MR_STATE(m);
+
+    if (state != SFG_MONSTER_STATE_INACTIVE)
+    {
+      RCL_Vector2D worldPosition;
+
+      worldPosition.x = SFG_MONSTER_COORD_TO_RCL_UNITS(m.coords[0]);
+      worldPosition.y = SFG_MONSTER_COORD_TO_RCL_UNITS(m.coords[1]);
+
+      uint8_t spriteSize = SFG_GET_MONSTER_SPRITE_SIZE(
+        SFG_MONSTER_TYPE_TO_INDEX(SFG_MR_TYPE(m)));
+
+      RCL_Unit worldHeight = 
+        SFG_floorHeightAt(
+          SFG_MONSTER_COORD_TO_SQUARES(m.coords[0]),
+          SFG_MONSTER_COORD_TO_SQUARES(m.coords[1]))
+          + SFG_SPRITE_SIZE_TO_HEIGHT_ABOVE_GROUND(spriteSize);
+
+      RCL_PixelInfo p =
+        RCL_mapToScreen(worldPosition,worldHeight,SFG_player.camera);
+
+      if (p.depth > 0 &&
+        SFG_SPRITE_IN_VIEW(worldPosition,worldHeight))
+      {
+        const uint8_t *s =
+          SFG_getMonsterSprite(
+            SFG_MR_TYPE(m),
+            state,
+            SFG_game.spriteAnimationFrame & 0x01);
+
+#if SFG_VIEW_REUSE
+        SFG_game.viewAnimated = 1;
+#endif
+
+        SFG_addViewSprite(s,
+          p.position.x * SFG_VIEW_SUBSAMPLE,p.position.y,
+          RCL_perspectiveScaleVertical(
+          SFG_SPRITE_SIZE_PIXELS(spriteSize),
+          p.depth),
+          p.depth / (RCL_UNITS_PER_SQUARE * 2),p.depth);
+      }
+    }
+  }
+
+  // item sprites:
+  for (int_fast16_t i = 0; i < SFG_currentLevel.itemRecordCount; ++i)
+    if (SFG_currentLevel.itemRecords[i] & SFG_ITEM_RECORD_ACTIVE_MASK)
+    {
+      RCL_Vector2D worldPosition;
+
+      SFG_LevelElement e = 
+        SFG_currentLevel.levelPointer->elements[
+          SFG_currentLevel.itemRecords[i] & ~SFG_ITEM_RECORD_ACTIVE_MASK];
+
+      worldPosition.x =
+        SFG_ELEMENT_COORD_TO_RCL_UNITS(e.coords[0]);
+
+      worldPosition.y =
+        SFG_ELEMENT_COORD_TO_RCL_UNITS(e.coords[1]);
+
+      const uint8_t *sprite;
+      uint8_t spriteSize;
+
+      SFG_getItemSprite(e.type,&sprite,&spriteSize);
+
+      if (sprite != 0)
+      {
+        RCL_Unit worldHeight = SFG_floorHeightAt(e.coords[0],e.coords[1])
+          + SFG_SPRITE_SIZE_TO_HEIGHT_ABOVE_GROUND(spriteSize);
+
+        RCL_PixelInfo p =
+          RCL_mapToScreen(worldPosition,worldHeight,SFG_player.camera);
+
+        if (p.depth > 0 &&
+          SFG_SPRITE_IN_VIEW(worldPosition,worldHeight))
+          SFG_addViewSprite(sprite,p.position.x * SFG_VIEW_SUBSAMPLE,
+            p.position.y,
+            RCL_perspectiveScaleVertical(SFG_SPRITE_SIZE_PIXELS(spriteSize),
+            p.depth),p.depth / (RCL_UNITS_PER_SQUARE * 2),p.depth);
+      }
+    }
+
+  // projectile sprites:
+  for (uint8_t i = 0; i < SFG_currentLevel.projectileRecordCount; ++i)
+  {
+    uint8_t type = SFG_currentLevel.projectileTypes[i];
+
+    if (type == SFG_PROJECTILE_BULLET)
+      continue; // bullets aren't drawn
+
+    RCL_Vector2D worldPosition;
+
+    worldPosition.x = SFG_currentLevel.projectilePositions[0][i];
+    worldPosition.y = SFG_currentLevel.projectilePositions[1][i];
+
+    RCL_Unit height = SFG_currentLevel.projectilePositions[2][i];
+
+    RCL_PixelInfo p =
+      RCL_mapToScreen(worldPosition,height,SFG_player.camera);
+     
+    const uint8_t *s =
+      SFG_effectSprites + type * SFG_TEXTURE_STORE_SIZE;
+
+    int16_t spriteSize = SFG_SPRITE_SIZE_PIXELS(0);
+
+    if (type == SFG_PROJECTILE_EXPLOSION ||
+        type == SFG_PROJECTILE_DUST)
+    {
+      int16_t doubleFramesToLive =
+        RCL_nonZero(SFG_GET_PROJECTILE_FRAMES_TO_LIVE(type) / 2);
+
+      // grow the explosion/dust sprite as an animation
+      spriteSize = (
+          SFG_SPRITE_SIZE_PIXELS(2) *
+          RCL_sin(          
+            ((doubleFramesToLive -
+             SFG_currentLevel.projectileDoubleFramesToLive[i]) *
+             RCL_UNITS_PER_SQUARE / 4)
+             / doubleFramesToLive) 
+        ) / RCL_UNITS_PER_SQUARE;
+    }
+
+    if (p.depth > 0 && 
+      SFG_SPRITE_IN_VIEW(worldPosition,height))
+      SFG_addViewSprite(s,
+          p.position.x * SFG_VIEW_SUBSAMPLE,p.position.y,
+          RCL_perspectiveScaleVertical(spriteSize,p.depth),
+          SFG_fogValueDiminish(p.depth),
+          p.depth);  
+  }
+
+  // draw the collected sprites from the nearest:
+
+  for (uint16_t i = 0; i < sizeof(SFG_game.spriteCover); ++i)
+    SFG_game.spriteCover[i] = 0;
+
+  for (uint16_t i = 0; i < SFG_game.viewSpriteCount; ++i)
+  {
+    SFG_ViewSprite *sprite = &(SFG_game.viewSprites[i]);
+
+    SFG_drawScaledSprite(sprite->image,sprite->x,sprite->y,sprite->size,
+      sprite->minusValue,sprite->depth);
+  }
+}
+
+#undef SFG_SPRITE_IN_VIEW
+
+void SFG_draw()
+{
   if (SFG_game.state == SFG_GAME_STATE_MENU)
   {
     SFG_drawMenu();
@@ -4720,9 +6877,6 @@ void SFG_draw()
   } 
   else
   { 
-    for (int_fast16_t i = 0; i < SFG_Z_BUFFER_SIZE; ++i)
-      SFG_game.zBuffer[i] = 255;
-
     int16_t weaponBobOffset = 0;
 
 #if SFG_HEADBOB_ENABLED
@@ -4761,142 +6915,31 @@ void SFG_draw()
     SFG_player.camera.height += headBobOffset;
 #endif // headbob enabled?
 
-    RCL_renderComplex(
-      SFG_player.camera,
-      SFG_floorHeightAt,
-      SFG_ceilingHeightAt,
-      SFG_texturesAt,
-      SFG_game.rayConstraints);
- 
-    // draw sprites:
+#if SFG_VIEW_REUSE
+    uint32_t viewKey = SFG_viewKey();
 
-    // monster sprites:
-    for (int_fast16_t i = 0; i < SFG_currentLevel.monsterRecordCount; ++i)
+    if (viewKey == SFG_game.viewKey && SFG_game.viewSaved)
+      SFG_restoreView();
+    else
     {
-      SFG_MonsterRecord m = SFG_currentLevel.monsterRecords[i];
-      uint8_t state = SFG_MR_STATE(m);
-
-      if (state != SFG_MONSTER_STATE_INACTIVE)
-      {
-        RCL_Vector2D worldPosition;
-
-        worldPosition.x = SFG_MONSTER_COORD_TO_RCL_UNITS(m.coords[0]);
-        worldPosition.y = SFG_MONSTER_COORD_TO_RCL_UNITS(m.coords[1]);
-
-        uint8_t spriteSize = SFG_GET_MONSTER_SPRITE_SIZE(
-          SFG_MONSTER_TYPE_TO_INDEX(SFG_MR_TYPE(m)));
-
-        RCL_Unit worldHeight = 
-          SFG_floorHeightAt(
-            SFG_MONSTER_COORD_TO_SQUARES(m.coords[0]),
-            SFG_MONSTER_COORD_TO_SQUARES(m.coords[1]))
-            + SFG_SPRITE_SIZE_TO_HEIGHT_ABOVE_GROUND(spriteSize);
-
-        RCL_PixelInfo p =
-          RCL_mapToScreen(worldPosition,worldHeight,SFG_player.camera);
+      SFG_drawView();
 
-        if (p.depth > 0 &&
-          SFG_spriteIsVisible(worldPosition,worldHeight))
-        {
-          const uint8_t *s =
-            SFG_getMonsterSprite(
-              SFG_MR_TYPE(m),
-              state,
-              SFG_game.spriteAnimationFrame & 0x01);
-
-          SFG_drawScaledSprite(s,
-            p.position.x * SFG_RAYCASTING_SUBSAMPLE,p.position.y,
-            RCL_perspectiveScaleVertical(
-            SFG_SPRITE_SIZE_PIXELS(spriteSize),
-            p.depth),
-            p.depth / (RCL_UNITS_PER_SQUARE * 2),p.depth);
-        }
-      }
-    }
-
-    // item sprites:
-    for (int_fast16_t i = 0; i < SFG_currentLevel.itemRecordCount; ++i)
-      if (SFG_currentLevel.itemRecords[i] & SFG_ITEM_RECORD_ACTIVE_MASK)
+      if (viewKey == SFG_game.viewKey)
       {
-        RCL_Vector2D worldPosition;
-
-        SFG_LevelElement e = 
-          SFG_currentLevel.levelPointer->elements[
-            SFG_currentLevel.itemRecords[i] & ~SFG_ITEM_RECORD_ACTIVE_MASK];
-
-        worldPosition.x =
-          SFG_ELEMENT_COORD_TO_RCL_UNITS(e.coords[0]);
-
-        worldPosition.y =
-          SFG_ELEMENT_COORD_TO_RCL_UNITS(e.coords[1]);
-
-        const uint8_t *sprite;
-        uint8_t spriteSize;
-
-        SFG_getItemSprite(e.type,&sprite,&spriteSize);
-
-        if (sprite != 0)
-        {
-          RCL_Unit worldHeight = SFG_floorHeightAt(e.coords[0],e.coords[1])
-            + SFG_SPRITE_SIZE_TO_HEIGHT_ABOVE_GROUND(spriteSize);
-
-          RCL_PixelInfo p =
-            RCL_mapToScreen(worldPosition,worldHeight,SFG_player.camera);
-
-          if (p.depth > 0 &&
-            SFG_spriteIsVisible(worldPosition,worldHeight))
-            SFG_drawScaledSprite(sprite,p.position.x * SFG_RAYCASTING_SUBSAMPLE,
-              p.position.y,
-              RCL_perspectiveScaleVertical(SFG_SPRITE_SIZE_PIXELS(spriteSize),
-              p.depth),p.depth / (RCL_UNITS_PER_SQUARE * 2),p.depth);
-        }
+        /* Only save the view once it's been the same for two frames so that
+           copying it isn't wasted while the player moves. */
+        SFG_saveView();
+        SFG_game.viewSaved = 1;
       }
-
-    // projectile sprites:
-    for (uint8_t i = 0; i < SFG_currentLevel.projectileRecordCount; ++i)
-    {
-      SFG_ProjectileRecord *proj = &(SFG_currentLevel.projectileRecords[i]);
-
-      if (proj->type == SFG_PROJECTILE_BULLET)
-        continue; // bullets aren't drawn
-
-      RCL_Vector2D worldPosition;
-
-      worldPosition.x = proj->position[0];
-      worldPosition.y = proj->position[1];
-
-      RCL_PixelInfo p =
-        RCL_mapToScreen(worldPosition,proj->position[2],SFG_player.camera);
-       
-      const uint8_t *s =
-        SFG_effectSprites + proj->type * SFG_TEXTURE_STORE_SIZE;
-
-      int16_t spriteSize = SFG_SPRITE_SIZE_PIXELS(0);
-
-      if (proj->type == SFG_PROJECTILE_EXPLOSION ||
-          proj->type == SFG_PROJECTILE_DUST)
+      else
       {
-        int16_t doubleFramesToLive =
-          RCL_nonZero(SFG_GET_PROJECTILE_FRAMES_TO_LIVE(proj->type) / 2);
-
-        // grow the explosion/dust sprite as an animation
-        spriteSize = (
-            SFG_SPRITE_SIZE_PIXELS(2) *
-            RCL_sin(          
-              ((doubleFramesToLive -
-               proj->doubleFramesToLive) * RCL_UNITS_PER_SQUARE / 4)
-               / doubleFramesToLive) 
-          ) / RCL_UNITS_PER_SQUARE;
+        SFG_game.viewKey = viewKey;
+        SFG_game.viewSaved = 0;
       }
-
-      if (p.depth > 0 && 
-        SFG_spriteIsVisible(worldPosition,proj->position[2]))
-        SFG_drawScaledSprite(s,
-            p.position.x * SFG_RAYCASTING_SUBSAMPLE,p.position.y,
-            RCL_perspectiveScaleVertical(spriteSize,p.depth),
-            SFG_fogValueDiminish(p.depth),
-            p.depth);  
     }
+#else
+    SFG_drawView();
+#endif
 
 #if SFG_HEADBOB_ENABLED
     // after rendering sprites substract back the head bob offset
@@ -5037,6 +7080,12 @@ uint8_t SFG_mainLoopBody()
       // render only once
       SFG_draw();
 
+#if SFG_QUALITY_GOVERNOR
+      SFG_updateQuality(SFG_getTimeMs() - timeNow);
+#endif
+
+      SFG_FRAME_DRAWN_COMMAND
+
       if (SFG_game.frame % 16 == 0)
         SFG_CPU_LOAD(((SFG_getTimeMs() - timeNow) * 100) / SFG_MS_PER_FRAME);
     }
@@ -154,6 +154,53 @@
                                                        approximated with the
                                                        help of this
                                                        constant). */
+#ifndef RCL_COLUMN_EARLY_OUT
+#define RCL_COLUMN_EARLY_OUT 1 /**< Whether RCL_renderComplex should stop
+                                    casting a column's ray as soon as the whole
+                                    column has been drawn, instead of finding
+                                    all hits allowed by the ray constraints. */
+#endif
+
+#ifndef RCL_RECIPROCAL_DIVISION
+#define RCL_RECIPROCAL_DIVISION 0 /**< If on, the divisions in rendering
+                                       columns (perspective of each hit and
+                                       wall texture steps) are done by
+                                       multiplying with reciprocals, computed
+                                       once per hit or looked up in a table.
+                                       The results are exactly the same, this
+                                       is faster on CPUs with slow division
+                                       but a fast 32x32->64 bit multiply. */
+#endif
+
+#ifndef RCL_RECIPROCAL_TABLE_SIZE
+#define RCL_RECIPROCAL_TABLE_SIZE 256 /**< Number of wall lengths (in pixels)
+                                           for which RCL_RECIPROCAL_DIVISION
+                                           keeps a reciprocal table, longer
+                                           walls are divided normally. */
+#endif
+
+#ifndef RCL_COUNT_RAY_STEPS
+#define RCL_COUNT_RAY_STEPS 0 /**< If on, the number of DDA steps made by all
+                                   cast rays is counted in RCL_rayStepCount
+                                   and the number of calls of the array
+                                   function while casting them in
+                                   RCL_rayLookupCount, e.g. to measure the
+                                   effect of RCL_COLUMN_EARLY_OUT. */
+#endif
+
+#ifndef RCL_RAY_PACKET_SIZE
+#define RCL_RAY_PACKET_SIZE 0 /**< If not 0, RCL_renderComplex casts the rays
+                                   of this many (4 or 8) adjacent columns
+                                   together, step by step, with one array
+                                   function call for all of them while they
+                                   are in the same square, and separate calls
+                                   when they aren't. The ray states are kept
+                                   in arrays so that the compiler can step
+                                   the rays with SIMD instructions. Rays may
+                                   be cast a few steps further than the
+                                   columns need. The image is the same. */
+#endif
+
 #ifndef RCL_VERTICAL_DEPTH_MULTIPLY
 #define RCL_VERTICAL_DEPTH_MULTIPLY 2 /**< Defines a multiplier of height
                                        difference when approximating floor/ceil
@@ -275,6 +322,38 @@ typedef struct
 
 void RCL_PIXEL_FUNCTION (RCL_PixelInfo *pixel);
 
+/**
+  Describes a vertical run of pixels in one column that share the same
+  RCL_PixelInfo except for the y position, depth and vertical texture
+  coordinate, which all change linearly along the run.
+*/
+typedef struct
+{
+  int16_t  start;         ///< Y position of the first pixel.
+  int16_t  length;        ///< Number of pixels in the run, at least 1.
+  int8_t   increment;     ///< Y step between successive pixels, 1 or -1.
+  RCL_Unit depth;         /**< Depth of the first pixel, i-th pixel has depth
+                               RCL_zeroClamp(depth + i * depthStep). */
+  RCL_Unit depthStep;     ///< Depth difference between successive pixels.
+  RCL_Unit texCoordY;     /**< Vertical texture coordinate of the first pixel
+                               (walls only) multiplied by
+                               RCL_TEXTURE_INTERPOLATION_SCALE. */
+  RCL_Unit texCoordYStep; ///< Scaled texture coordinate step between pixels.
+} RCL_SpanInfo;
+
+#ifdef RCL_SPAN_FUNCTION
+/**
+  Optional function whose name can be defined the same way as with
+  RCL_PIXEL_FUNCTION. If defined, RCL_renderComplex hands wall pixels and
+  floor/ceiling pixels without texture coordinates to it in whole vertical runs
+  instead of calling RCL_PIXEL_FUNCTION for each of them, so that the per-run
+  work (texture selection, shading setup etc.) can be done only once. It has
+  to draw the pixels exactly as RCL_PIXEL_FUNCTION would, in the order of the
+  run.
+*/
+void RCL_SPAN_FUNCTION(RCL_PixelInfo *pixel, RCL_SpanInfo *span);
+#endif
+
 typedef struct
 {
   uint16_t maxHits;
@@ -296,6 +375,18 @@ typedef RCL_Unit (*RCL_ArrayFunction)(int16_t x, int16_t y);
   like with pixelFunc? Could be more efficient than function pointers.
 */
 
+#ifdef RCL_FLOOR_CEIL_FUNCTION
+/**
+  Optional function whose name can be defined the same way as with
+  RCL_PIXEL_FUNCTION. It returns both floor and ceiling height of given square
+  packed into one number the same way as _RCL_floorCeilFunction does it. If
+  defined, RCL_renderComplex calls it for each ray step instead of calling the
+  floor and ceiling functions through pointers, so it has to return the same
+  heights as those functions.
+*/
+RCL_Unit RCL_FLOOR_CEIL_FUNCTION(int16_t x, int16_t y);
+#endif
+
 /**
   Function that renders a single pixel at the display. It is handed an info
   about the pixel it should draw.
@@ -412,6 +503,16 @@ void RCL_castRaysMultiHit(RCL_Camera cam, RCL_ArrayFunction arrayFunc,
   RCL_ArrayFunction typeFunction, RCL_ColumnFunction columnFunc,
   RCL_RayConstraints constraints);
 
+/**
+  Same as RCL_castRaysMultiHit, but only casts rays for screen columns in range
+  [fromX,toX). Rays of each column are the same as the ones cast by
+  RCL_castRaysMultiHit, so different ranges can be cast independently (e.g. in
+  parallel).
+*/
+void RCL_castRaysMultiHitColumns(RCL_Camera cam, RCL_ArrayFunction arrayFunc,
+  RCL_ArrayFunction typeFunction, RCL_ColumnFunction columnFunc,
+  RCL_RayConstraints constraints, int16_t fromX, int16_t toX);
+
 /**
   Using provided functions, renders a complete complex (multilevel) camera
   view.
@@ -443,6 +544,28 @@ void RCL_renderComplex(RCL_Camera cam, RCL_ArrayFunction floorHeightFunc,
   RCL_ArrayFunction ceilingHeightFunc, RCL_ArrayFunction typeFunction,
   RCL_RayConstraints constraints);
 
+/**
+  Prepares rendering of a complex camera view in parts with
+  RCL_renderComplexColumns. Parameters are the same as with RCL_renderComplex.
+
+  This allows splitting the screen to several column ranges that can be
+  rendered independently, e.g. by different threads: after this function
+  returns, the library state is only read while rendering the columns, so
+  RCL_renderComplexColumns may be called concurrently for non-overlapping
+  ranges (as long as the pixel function is also OK with this). Floor texture
+  coordinates (RCL_COMPUTE_FLOOR_TEXCOORDS) are not supported in this mode.
+*/
+void RCL_renderComplexBegin(RCL_Camera cam, RCL_ArrayFunction floorHeightFunc,
+  RCL_ArrayFunction ceilingHeightFunc, RCL_ArrayFunction typeFunction,
+  RCL_RayConstraints constraints);
+
+/**
+  Renders screen columns in range [fromX,toX) of the view prepared by
+  RCL_renderComplexBegin. Rendering all the columns this way results in the
+  same image as RCL_renderComplex.
+*/
+void RCL_renderComplexColumns(int16_t fromX, int16_t toX);
+
 /**
   Renders given camera view, with help of provided functions. This function is
   simpler and faster than RCL_renderComplex(...) and is meant to be rendering
@@ -518,6 +641,15 @@ int16_t _RCL_cameraHeightScreen = 0;
 RCL_ArrayFunction _RCL_rollFunction = 0; // says door rolling
 RCL_Unit *_RCL_floorPixelDistances = 0;
 RCL_Unit _RCL_fovCorrectionFactors[2] = {0,0}; //correction for hor/vert fov
+RCL_ArrayFunction _RCL_typeFunction = 0;
+RCL_RayConstraints _RCL_rayConstraints;
+
+#if RCL_COUNT_RAY_STEPS
+uint32_t RCL_rayStepCount = 0; ///< Number of DDA steps made by all rays.
+uint32_t RCL_rayLookupCount = 0; ///< Array function calls made by all rays.
+#endif
+
+RCL_Unit _RCL_fovCorrectionFactor(RCL_Unit fov);
 
 RCL_Unit RCL_clamp(RCL_Unit value, RCL_Unit valueMin, RCL_Unit valueMax)
 {
@@ -734,208 +866,462 @@ static inline int8_t RCL_pointIsLeftOfRay(RCL_Vector2D point, RCL_Ray ray)
          // ^ Z component of cross-product
 }
 
-void RCL_castRayMultiHit(RCL_Ray ray, RCL_ArrayFunction arrayFunc,
-  RCL_ArrayFunction typeFunc, RCL_HitResult *hitResults,
-  uint16_t *hitResultsLen, RCL_RayConstraints constraints)
+/// State of a ray being cast step by step, see _RCL_nextRayHit.
+typedef struct
 {
-  RCL_Vector2D currentPos = ray.start;
+  RCL_Ray      ray;
   RCL_Vector2D currentSquare;
+  RCL_Vector2D nextSideDist;  ///< dist. from start to the next side in an axis
+  RCL_Vector2D delta;
+  RCL_Vector2D step;          ///< -1 or 1 for each axis
+  int8_t       stepHorizontal; ///< whether the last step was hor. or vert.
+  RCL_Unit     squareType;
+  RCL_Unit     rayDirXRecip;
+  RCL_Unit     rayDirYRecip;
+  uint16_t     stepCount;
+} _RCL_RayState;
 
-  currentSquare.x = RCL_divRoundDown(ray.start.x,RCL_UNITS_PER_SQUARE);
-  currentSquare.y = RCL_divRoundDown(ray.start.y,RCL_UNITS_PER_SQUARE);
-
-  *hitResultsLen = 0;
-
-  RCL_Unit squareType = arrayFunc(currentSquare.x,currentSquare.y);
+#define _RCL_RECIP_SCALE 65536
 
-  // DDA variables
-  RCL_Vector2D nextSideDist; // dist. from start to the next side in given axis
-  RCL_Vector2D delta;
-  RCL_Vector2D step;         // -1 or 1 for each axis
-  int8_t stepHorizontal = 0; // whether the last step was hor. or vert.
+/**
+  Prepares casting given ray like _RCL_initRayState, except for looking up the
+  type of the start square.
+*/
+static inline void _RCL_initRayGeometry(_RCL_RayState *s, RCL_Ray ray)
+{
+  s->ray = ray;
+  s->stepHorizontal = 0;
+  s->stepCount = 0;
 
-  nextSideDist.x = 0;
-  nextSideDist.y = 0;
+  s->currentSquare.x = RCL_divRoundDown(ray.start.x,RCL_UNITS_PER_SQUARE);
+  s->currentSquare.y = RCL_divRoundDown(ray.start.y,RCL_UNITS_PER_SQUARE);
 
   RCL_Unit dirVecLengthNorm = RCL_len(ray.direction) * RCL_UNITS_PER_SQUARE;
 
-  delta.x = RCL_abs(dirVecLengthNorm / RCL_nonZero(ray.direction.x));
-  delta.y = RCL_abs(dirVecLengthNorm / RCL_nonZero(ray.direction.y));
-
-  // init DDA
+  s->delta.x = RCL_abs(dirVecLengthNorm / RCL_nonZero(ray.direction.x));
+  s->delta.y = RCL_abs(dirVecLengthNorm / RCL_nonZero(ray.direction.y));
 
   if (ray.direction.x < 0)
   {
-    step.x = -1;
-    nextSideDist.x = (RCL_wrap(ray.start.x,RCL_UNITS_PER_SQUARE) * delta.x) /
-                       RCL_UNITS_PER_SQUARE;
+    s->step.x = -1;
+    s->nextSideDist.x =
+      (RCL_wrap(ray.start.x,RCL_UNITS_PER_SQUARE) * s->delta.x) /
+        RCL_UNITS_PER_SQUARE;
   }
   else
   {
-    step.x = 1;
-    nextSideDist.x =
+    s->step.x = 1;
+    s->nextSideDist.x =
       ((RCL_wrap(RCL_UNITS_PER_SQUARE - ray.start.x,RCL_UNITS_PER_SQUARE)) *
-        delta.x) / RCL_UNITS_PER_SQUARE;
+        s->delta.x) / RCL_UNITS_PER_SQUARE;
   }
 
   if (ray.direction.y < 0)
   {
-    step.y = -1;
-    nextSideDist.y = (RCL_wrap(ray.start.y,RCL_UNITS_PER_SQUARE) * delta.y) /
-                       RCL_UNITS_PER_SQUARE;
+    s->step.y = -1;
+    s->nextSideDist.y =
+      (RCL_wrap(ray.start.y,RCL_UNITS_PER_SQUARE) * s->delta.y) /
+        RCL_UNITS_PER_SQUARE;
   }
   else
   {
-    step.y = 1;
-    nextSideDist.y =
+    s->step.y = 1;
+    s->nextSideDist.y =
       ((RCL_wrap(RCL_UNITS_PER_SQUARE - ray.start.y,RCL_UNITS_PER_SQUARE)) *
-        delta.y) / RCL_UNITS_PER_SQUARE;
+        s->delta.y) / RCL_UNITS_PER_SQUARE;
   }
 
-  // DDA loop
-
-  #define RECIP_SCALE 65536
-
-  RCL_Unit rayDirXRecip = RECIP_SCALE / RCL_nonZero(ray.direction.x);
-  RCL_Unit rayDirYRecip = RECIP_SCALE / RCL_nonZero(ray.direction.y);
+  s->rayDirXRecip = _RCL_RECIP_SCALE / RCL_nonZero(ray.direction.x);
+  s->rayDirYRecip = _RCL_RECIP_SCALE / RCL_nonZero(ray.direction.y);
   // ^ we precompute reciprocals to avoid divisions in the loop
+}
 
-  for (uint16_t i = 0; i < constraints.maxSteps; ++i)
-  {
-    RCL_Unit currentType = arrayFunc(currentSquare.x,currentSquare.y);
+/// Prepares casting given ray with _RCL_nextRayHit.
+static inline void _RCL_initRayState(_RCL_RayState *s, RCL_Ray ray,
+  RCL_ArrayFunction arrayFunc)
+{
+  _RCL_initRayGeometry(s,ray);
 
-    if (RCL_unlikely(currentType != squareType))
-    {
-      // collision
+  s->squareType = arrayFunc(s->currentSquare.x,s->currentSquare.y);
 
-      RCL_HitResult h;
+#if RCL_COUNT_RAY_STEPS
+  RCL_rayLookupCount++;
+#endif
+}
+
+/**
+  Fills the hit result of a ray (with the reciprocals of its direction as
+  computed by _RCL_initRayState) that has entered given square of given type
+  with its last DDA step.
+*/
+static inline void _RCL_makeRayHit(RCL_Ray ray, RCL_Vector2D currentSquare,
+  int8_t stepHorizontal, RCL_Vector2D step, RCL_Unit rayDirXRecip,
+  RCL_Unit rayDirYRecip, RCL_Unit currentType, RCL_ArrayFunction typeFunc,
+  RCL_HitResult *hit)
+{
+  RCL_HitResult h;
 
-      h.arrayValue = currentType;
-      h.doorRoll = 0;
-      h.position = currentPos;
-      h.square   = currentSquare;
+  h.arrayValue = currentType;
+  h.doorRoll = 0;
+  h.square   = currentSquare;
 
-      if (stepHorizontal)
-      {
-        h.position.x = currentSquare.x * RCL_UNITS_PER_SQUARE;
-        h.direction = 3;
+  if (stepHorizontal)
+  {
+    h.position.x = currentSquare.x * RCL_UNITS_PER_SQUARE;
+    h.direction = 3;
 
-        if (step.x == -1)
-        {
-          h.direction = 1;
-          h.position.x += RCL_UNITS_PER_SQUARE;
-        }
+    if (step.x == -1)
+    {
+      h.direction = 1;
+      h.position.x += RCL_UNITS_PER_SQUARE;
+    }
 
-        RCL_Unit diff = h.position.x - ray.start.x;
+    RCL_Unit diff = h.position.x - ray.start.x;
 
-        h.position.y = // avoid division by multiplying with reciprocal
-          ray.start.y + (ray.direction.y * diff * rayDirXRecip) / RECIP_SCALE;
+    h.position.y = // avoid division by multiplying with reciprocal
+      ray.start.y + (ray.direction.y * diff * rayDirXRecip) /
+      _RCL_RECIP_SCALE;
 
 #if RCL_RECTILINEAR
-        /* Here we compute the fish eye corrected distance (perpendicular to
-        the projection plane) as the Euclidean distance (of hit from camera
-        position) divided by the length of the ray direction vector. This can
-        be computed without actually computing Euclidean distances as a
-        hypothenuse A (distance) divided by hypothenuse B (length) is equal to
-        leg A (distance along principal axis) divided by leg B (length along
-        the same principal axis). */
+    /* Here we compute the fish eye corrected distance (perpendicular to
+    the projection plane) as the Euclidean distance (of hit from camera
+    position) divided by the length of the ray direction vector. This can
+    be computed without actually computing Euclidean distances as a
+    hypothenuse A (distance) divided by hypothenuse B (length) is equal to
+    leg A (distance along principal axis) divided by leg B (length along
+    the same principal axis). */
 
 #define CORRECT(dir1,dir2)\
   RCL_Unit tmp = diff / 4;        /* 4 to prevent overflow */ \
   h.distance = ((tmp / 8) != 0) ? /* prevent a bug with small dists */ \
-    ((tmp * RCL_UNITS_PER_SQUARE * rayDir ## dir1 ## Recip) / (RECIP_SCALE / 4)):\
-    RCL_abs(h.position.dir2 - ray.start.dir2);
+    ((tmp * RCL_UNITS_PER_SQUARE * rayDir ## dir1 ## Recip) / \
+    (_RCL_RECIP_SCALE / 4)) : RCL_abs(h.position.dir2 - ray.start.dir2);
 
-        CORRECT(X,y)
+    CORRECT(X,y)
 
 #endif // RCL_RECTILINEAR
-      }
-      else
-      {
-        h.position.y = currentSquare.y * RCL_UNITS_PER_SQUARE;
-        h.direction = 2;
+  }
+  else
+  {
+    h.position.y = currentSquare.y * RCL_UNITS_PER_SQUARE;
+    h.direction = 2;
 
-        if (step.y == -1)
-        {
-          h.direction = 0;
-          h.position.y += RCL_UNITS_PER_SQUARE;
-        }
+    if (step.y == -1)
+    {
+      h.direction = 0;
+      h.position.y += RCL_UNITS_PER_SQUARE;
+    }
 
-        RCL_Unit diff = h.position.y - ray.start.y;
+    RCL_Unit diff = h.position.y - ray.start.y;
 
-        h.position.x =
-          ray.start.x + (ray.direction.x * diff * rayDirYRecip) / RECIP_SCALE;
+    h.position.x =
+      ray.start.x + (ray.direction.x * diff * rayDirYRecip) /
+      _RCL_RECIP_SCALE;
 
 #if RCL_RECTILINEAR
 
-        CORRECT(Y,x) // same as above but for different axis
+    CORRECT(Y,x) // same as above but for different axis
 
 #undef CORRECT
 
 #endif // RCL_RECTILINEAR
-      }
+  }
 
 #if !RCL_RECTILINEAR
-      h.distance = RCL_dist(h.position,ray.start);
+  h.distance = RCL_dist(h.position,ray.start);
 #endif
-      if (typeFunc != 0)
-        h.type = typeFunc(currentSquare.x,currentSquare.y);
+  if (typeFunc != 0)
+    h.type = typeFunc(currentSquare.x,currentSquare.y);
 
 #if RCL_COMPUTE_WALL_TEXCOORDS == 1
-      switch (h.direction)
-      {
-        case 0: h.textureCoord =
-          RCL_wrap(-1 * h.position.x,RCL_UNITS_PER_SQUARE); break;
+  switch (h.direction)
+  {
+    case 0: h.textureCoord =
+      RCL_wrap(-1 * h.position.x,RCL_UNITS_PER_SQUARE); break;
 
-        case 1: h.textureCoord =
-          RCL_wrap(h.position.y,RCL_UNITS_PER_SQUARE); break;
+    case 1: h.textureCoord =
+      RCL_wrap(h.position.y,RCL_UNITS_PER_SQUARE); break;
 
-        case 2: h.textureCoord =
-          RCL_wrap(h.position.x,RCL_UNITS_PER_SQUARE); break;
+    case 2: h.textureCoord =
+      RCL_wrap(h.position.x,RCL_UNITS_PER_SQUARE); break;
 
-        case 3: h.textureCoord =
-          RCL_wrap(-1 * h.position.y,RCL_UNITS_PER_SQUARE); break;
+    case 3: h.textureCoord =
+      RCL_wrap(-1 * h.position.y,RCL_UNITS_PER_SQUARE); break;
 
-        default: h.textureCoord = 0; break;
-      }
+    default: h.textureCoord = 0; break;
+  }
 
-      if (_RCL_rollFunction != 0)
-      {
-        h.doorRoll = _RCL_rollFunction(currentSquare.x,currentSquare.y);
-        
-        if (h.direction == 0 || h.direction == 1)
-          h.doorRoll *= -1;
-      }
+  if (_RCL_rollFunction != 0)
+  {
+    h.doorRoll = _RCL_rollFunction(currentSquare.x,currentSquare.y);
+    
+    if (h.direction == 0 || h.direction == 1)
+      h.doorRoll *= -1;
+  }
 
 #else
-      h.textureCoord = 0;
+  h.textureCoord = 0;
 #endif
 
-      hitResults[*hitResultsLen] = h;
+  *hit = h;
+}
 
-      *hitResultsLen += 1;
+/**
+  Continues casting a ray (prepared with _RCL_initRayState) until it collides
+  with a square of a different type or until maxSteps steps have been made in
+  total. Returns 1 and fills the hit result if a collision happened, otherwise
+  returns 0. This allows stopping the ray as soon as no more hits are needed.
+*/
+static inline int8_t _RCL_nextRayHit(_RCL_RayState *s,
+  RCL_ArrayFunction arrayFunc, RCL_ArrayFunction typeFunc, uint16_t maxSteps,
+  RCL_HitResult *hit)
+{
+  while (s->stepCount < maxSteps)
+  {
+    RCL_Unit currentType = arrayFunc(s->currentSquare.x,s->currentSquare.y);
+    int8_t collided = currentType != s->squareType;
 
-      squareType = currentType;
+    if (RCL_unlikely(collided))
+    {
+      _RCL_makeRayHit(s->ray,s->currentSquare,s->stepHorizontal,s->step,
+        s->rayDirXRecip,s->rayDirYRecip,currentType,typeFunc,hit);
 
-      if (*hitResultsLen >= constraints.maxHits)
-        break;
+      s->squareType = currentType;
     }
 
     // DDA step
 
-    if (nextSideDist.x < nextSideDist.y)
+    if (s->nextSideDist.x < s->nextSideDist.y)
     {
-      nextSideDist.x += delta.x;
-      currentSquare.x += step.x;
-      stepHorizontal = 1;
+      s->nextSideDist.x += s->delta.x;
+      s->currentSquare.x += s->step.x;
+      s->stepHorizontal = 1;
     }
     else
     {
-      nextSideDist.y += delta.y;
-      currentSquare.y += step.y;
-      stepHorizontal = 0;
+      s->nextSideDist.y += s->delta.y;
+      s->currentSquare.y += s->step.y;
+      s->stepHorizontal = 0;
+    }
+
+    s->stepCount++;
+
+#if RCL_COUNT_RAY_STEPS
+    RCL_rayStepCount++;
+    RCL_rayLookupCount++;
+#endif
+
+    if (collided)
+      return 1;
+  }
+
+  return 0;
+}
+
+#if RCL_RAY_PACKET_SIZE > 0
+
+#define _RCL_PACKET_QUEUE 4 ///< max. hits a ray of a packet can be ahead by
+
+/**
+  State of the rays of adjacent columns cast together, see _RCL_stepRayPacket.
+  Each ray (lane) keeps the hits found ahead of its column in a small queue.
+*/
+typedef struct
+{
+  RCL_Unit      squareX[RCL_RAY_PACKET_SIZE];
+  RCL_Unit      squareY[RCL_RAY_PACKET_SIZE];
+  RCL_Unit      nextSideDistX[RCL_RAY_PACKET_SIZE];
+  RCL_Unit      nextSideDistY[RCL_RAY_PACKET_SIZE];
+  RCL_Unit      deltaX[RCL_RAY_PACKET_SIZE];
+  RCL_Unit      deltaY[RCL_RAY_PACKET_SIZE];
+  RCL_Unit      stepX[RCL_RAY_PACKET_SIZE];
+  RCL_Unit      stepY[RCL_RAY_PACKET_SIZE];
+  RCL_Unit      stepHorizontal[RCL_RAY_PACKET_SIZE];
+  RCL_Unit      squareType[RCL_RAY_PACKET_SIZE];
+  RCL_Unit      stepCount[RCL_RAY_PACKET_SIZE];
+  RCL_Unit      rayDirXRecip[RCL_RAY_PACKET_SIZE];
+  RCL_Unit      rayDirYRecip[RCL_RAY_PACKET_SIZE];
+  RCL_Ray       ray[RCL_RAY_PACKET_SIZE];
+  uint8_t       running[RCL_RAY_PACKET_SIZE]; ///< whether the lane is needed
+  uint8_t       hitFirst[RCL_RAY_PACKET_SIZE];
+  uint8_t       hitCount[RCL_RAY_PACKET_SIZE];
+  RCL_HitResult hits[RCL_RAY_PACKET_SIZE][_RCL_PACKET_QUEUE];
+} _RCL_RayPacket;
+
+/**
+  Prepares casting rayCount (at most RCL_RAY_PACKET_SIZE) rays starting at the
+  same position together, the rest of the lanes stay unused.
+*/
+static inline void _RCL_initRayPacket(_RCL_RayPacket *p, RCL_Ray *rays,
+  uint8_t rayCount, RCL_ArrayFunction arrayFunc)
+{
+  for (uint8_t i = 0; i < RCL_RAY_PACKET_SIZE; ++i)
+  {
+    _RCL_RayState s;
+
+    _RCL_initRayGeometry(&s,rays[i < rayCount ? i : 0]);
+
+    p->squareX[i] = s.currentSquare.x;
+    p->squareY[i] = s.currentSquare.y;
+    p->nextSideDistX[i] = s.nextSideDist.x;
+    p->nextSideDistY[i] = s.nextSideDist.y;
+    p->deltaX[i] = s.delta.x;
+    p->deltaY[i] = s.delta.y;
+    p->stepX[i] = s.step.x;
+    p->stepY[i] = s.step.y;
+    p->stepHorizontal[i] = 0;
+    p->stepCount[i] = 0;
+    p->rayDirXRecip[i] = s.rayDirXRecip;
+    p->rayDirYRecip[i] = s.rayDirYRecip;
+    p->ray[i] = s.ray;
+    p->running[i] = i < rayCount;
+    p->hitFirst[i] = 0;
+    p->hitCount[i] = 0;
+  }
+
+  // all rays start in the same square
+  RCL_Unit type = arrayFunc(p->squareX[0],p->squareY[0]);
+
+#if RCL_COUNT_RAY_STEPS
+  RCL_rayLookupCount++;
+#endif
+
+  for (uint8_t i = 0; i < RCL_RAY_PACKET_SIZE; ++i)
+    p->squareType[i] = type;
+}
+
+/**
+  Makes one DDA step with each running ray of a packet that has room for
+  another hit and hasn't made maxSteps steps yet, the same step
+  _RCL_nextRayHit would make. Found hits are queued in the lanes.
+*/
+static inline void _RCL_stepRayPacket(_RCL_RayPacket *p,
+  RCL_ArrayFunction arrayFunc, RCL_ArrayFunction typeFunc, uint16_t maxSteps)
+{
+  RCL_Unit active[RCL_RAY_PACKET_SIZE];
+  RCL_Unit type[RCL_RAY_PACKET_SIZE];
+  int8_t first = -1;
+  int8_t together = 1;
+
+  for (uint8_t i = 0; i < RCL_RAY_PACKET_SIZE; ++i)
+  {
+    active[i] = p->running[i] && p->stepCount[i] < maxSteps &&
+      p->hitCount[i] < _RCL_PACKET_QUEUE;
+
+    if (active[i])
+    {
+      if (first < 0)
+        first = i;
+      else if (p->squareX[i] != p->squareX[first] ||
+        p->squareY[i] != p->squareY[first])
+        together = 0;
+    }
+  }
+
+  if (first < 0)
+    return;
+
+  if (together)
+  {
+    RCL_Unit t = arrayFunc(p->squareX[first],p->squareY[first]);
+
+#if RCL_COUNT_RAY_STEPS
+    RCL_rayLookupCount++;
+#endif
+
+    for (uint8_t i = 0; i < RCL_RAY_PACKET_SIZE; ++i)
+      type[i] = t;
+  }
+  else
+    for (uint8_t i = 0; i < RCL_RAY_PACKET_SIZE; ++i)
+      if (active[i])
+      {
+        type[i] = arrayFunc(p->squareX[i],p->squareY[i]);
+
+#if RCL_COUNT_RAY_STEPS
+        RCL_rayLookupCount++;
+#endif
+      }
+
+  for (uint8_t i = 0; i < RCL_RAY_PACKET_SIZE; ++i)
+    if (active[i] && RCL_unlikely(type[i] != p->squareType[i]))
+    {
+      RCL_Vector2D square, step;
+
+      square.x = p->squareX[i];
+      square.y = p->squareY[i];
+      step.x = p->stepX[i];
+      step.y = p->stepY[i];
+
+      _RCL_makeRayHit(p->ray[i],square,p->stepHorizontal[i],step,
+        p->rayDirXRecip[i],p->rayDirYRecip[i],type[i],typeFunc,
+        &(p->hits[i][(p->hitFirst[i] + p->hitCount[i]) % _RCL_PACKET_QUEUE]));
+
+      p->hitCount[i]++;
+      p->squareType[i] = type[i];
     }
+
+  // DDA step, without branches so that it can be vectorized
+
+  for (uint8_t i = 0; i < RCL_RAY_PACKET_SIZE; ++i)
+  {
+    RCL_Unit horizontal = p->nextSideDistX[i] < p->nextSideDistY[i];
+    RCL_Unit stepX = active[i] & horizontal;
+    RCL_Unit stepY = active[i] & !horizontal;
+
+    p->nextSideDistX[i] += stepX * p->deltaX[i];
+    p->squareX[i] += stepX * p->stepX[i];
+    p->nextSideDistY[i] += stepY * p->deltaY[i];
+    p->squareY[i] += stepY * p->stepY[i];
+    p->stepHorizontal[i] = active[i] ? horizontal : p->stepHorizontal[i];
+    p->stepCount[i] += active[i];
+  }
+
+#if RCL_COUNT_RAY_STEPS
+  for (uint8_t i = 0; i < RCL_RAY_PACKET_SIZE; ++i)
+    RCL_rayStepCount += active[i];
+#endif
+}
+
+/**
+  Packet version of _RCL_nextRayHit for given lane: gives the next hit of the
+  lane's ray, stepping the whole packet as long as there is none queued.
+*/
+static inline int8_t _RCL_nextPacketHit(_RCL_RayPacket *p, uint8_t lane,
+  RCL_ArrayFunction arrayFunc, RCL_ArrayFunction typeFunc, uint16_t maxSteps,
+  RCL_HitResult *hit)
+{
+  while (p->hitCount[lane] == 0)
+  {
+    if (p->stepCount[lane] >= maxSteps)
+      return 0;
+
+    _RCL_stepRayPacket(p,arrayFunc,typeFunc,maxSteps);
   }
+
+  *hit = p->hits[lane][p->hitFirst[lane]];
+  p->hitFirst[lane] = (p->hitFirst[lane] + 1) % _RCL_PACKET_QUEUE;
+  p->hitCount[lane]--;
+
+  return 1;
+}
+
+#endif // RCL_RAY_PACKET_SIZE > 0
+
+void RCL_castRayMultiHit(RCL_Ray ray, RCL_ArrayFunction arrayFunc,
+  RCL_ArrayFunction typeFunc, RCL_HitResult *hitResults,
+  uint16_t *hitResultsLen, RCL_RayConstraints constraints)
+{
+  _RCL_RayState state;
+
+  _RCL_initRayState(&state,ray,arrayFunc);
+
+  *hitResultsLen = 0;
+
+  while (*hitResultsLen < constraints.maxHits &&
+    _RCL_nextRayHit(&state,arrayFunc,typeFunc,constraints.maxSteps,
+      hitResults + *hitResultsLen))
+    *hitResultsLen += 1;
 }
 
 RCL_HitResult RCL_castRay(RCL_Ray ray, RCL_ArrayFunction arrayFunc)
@@ -959,8 +1345,18 @@ void RCL_castRaysMultiHit(RCL_Camera cam, RCL_ArrayFunction arrayFunc,
   RCL_ArrayFunction typeFunction, RCL_ColumnFunction columnFunc,
   RCL_RayConstraints constraints)
 {
-  RCL_Vector2D dir1 =
-    RCL_angleToDirection(cam.direction - RCL_HORIZONTAL_FOV_HALF);
+  RCL_castRaysMultiHitColumns(cam,arrayFunc,typeFunction,columnFunc,
+    constraints,0,cam.resolution.x);
+}
+
+/**
+  Computes the directions of the leftmost ray and the difference between the
+  rightmost and leftmost ray, from which the ray of each screen column is
+  interpolated by _RCL_columnRay.
+*/
+void _RCL_columnRays(RCL_Camera cam, RCL_Vector2D *dir1, RCL_Vector2D *dirDiff)
+{
+  *dir1 = RCL_angleToDirection(cam.direction - RCL_HORIZONTAL_FOV_HALF);
 
   RCL_Vector2D dir2 =
     RCL_angleToDirection(cam.direction + RCL_HORIZONTAL_FOV_HALF);
@@ -970,39 +1366,50 @@ void RCL_castRaysMultiHit(RCL_Camera cam, RCL_ArrayFunction arrayFunc,
 
   RCL_Unit cos = RCL_nonZero(RCL_cos(RCL_HORIZONTAL_FOV_HALF));
 
-  dir1.x = (dir1.x * RCL_UNITS_PER_SQUARE) / cos;
-  dir1.y = (dir1.y * RCL_UNITS_PER_SQUARE) / cos;
+  dir1->x = (dir1->x * RCL_UNITS_PER_SQUARE) / cos;
+  dir1->y = (dir1->y * RCL_UNITS_PER_SQUARE) / cos;
 
   dir2.x = (dir2.x * RCL_UNITS_PER_SQUARE) / cos;
   dir2.y = (dir2.y * RCL_UNITS_PER_SQUARE) / cos;
 
-  RCL_Unit dX = dir2.x - dir1.x;
-  RCL_Unit dY = dir2.y - dir1.y;
-
-  RCL_HitResult hits[constraints.maxHits];
-  uint16_t hitCount;
+  dirDiff->x = dir2.x - dir1->x;
+  dirDiff->y = dir2.y - dir1->y;
+}
 
+static inline RCL_Ray _RCL_columnRay(RCL_Camera *cam, RCL_Vector2D dir1,
+  RCL_Vector2D dirDiff, int16_t x)
+{
   RCL_Ray r;
-  r.start = cam.position;
+  r.start = cam->position;
 
-  RCL_Unit currentDX = 0;
-  RCL_Unit currentDY = 0;
+  /* Here by linearly interpolating the direction vector its length changes,
+  which in result achieves correcting the fish eye effect (computing
+  perpendicular distance). */
 
-  for (int16_t i = 0; i < cam.resolution.x; ++i)
-  {
-    /* Here by linearly interpolating the direction vector its length changes,
-    which in result achieves correcting the fish eye effect (computing
-    perpendicular distance). */
+  r.direction.x = dir1.x + (x * dirDiff.x) / cam->resolution.x;
+  r.direction.y = dir1.y + (x * dirDiff.y) / cam->resolution.x;
+
+  return r;
+}
+
+void RCL_castRaysMultiHitColumns(RCL_Camera cam, RCL_ArrayFunction arrayFunc,
+  RCL_ArrayFunction typeFunction, RCL_ColumnFunction columnFunc,
+  RCL_RayConstraints constraints, int16_t fromX, int16_t toX)
+{
+  RCL_Vector2D dir1, dirDiff;
 
-    r.direction.x = dir1.x + currentDX / cam.resolution.x;
-    r.direction.y = dir1.y + currentDY / cam.resolution.x;
+  _RCL_columnRays(cam,&dir1,&dirDiff);
+
+  RCL_HitResult hits[constraints.maxHits];
+  uint16_t hitCount;
+
+  for (int16_t i = fromX; i < toX; ++i)
+  {
+    RCL_Ray r = _RCL_columnRay(&cam,dir1,dirDiff,i);
 
     RCL_castRayMultiHit(r,arrayFunc,typeFunction,hits,&hitCount,constraints);
 
     columnFunc(hits,hitCount,i,r);
-
-    currentDX += dX;
-    currentDY += dY;
   }
 }
 
@@ -1011,6 +1418,9 @@ void RCL_castRaysMultiHit(RCL_Camera cam, RCL_ArrayFunction arrayFunc,
 */
 RCL_Unit _RCL_floorCeilFunction(int16_t x, int16_t y)
 {
+#ifdef RCL_FLOOR_CEIL_FUNCTION
+  return RCL_FLOOR_CEIL_FUNCTION(x,y);
+#else
   RCL_Unit f = _RCL_floorFunction(x,y);
 
   if (_RCL_ceilFunction == 0)
@@ -1023,6 +1433,7 @@ RCL_Unit _RCL_floorCeilFunction(int16_t x, int16_t y)
 #else
   return ((f & 0x00ff) << 8) | (c & 0x00ff);
 #endif
+#endif
 }
 
 RCL_Unit _floorHeightNotZeroFunction(int16_t x, int16_t y)
@@ -1120,6 +1531,46 @@ static inline int16_t _RCL_drawHorizontalColumn(
     }\
   }
 
+#ifdef RCL_SPAN_FUNCTION
+  if (!computeCoords)
+  {
+    RCL_SpanInfo span;
+
+    span.length = increment == -1 ? yCurrent - limit : limit - yCurrent;
+
+    if (span.length > 0)
+    {
+      span.start = yCurrent + increment;
+      span.increment = increment;
+      span.texCoordY = 0;
+      span.texCoordYStep = 0;
+
+      if (computeDepth)
+      {
+        span.depthStep = depthIncrementMultiplier * _RCL_horizontalDepthStep;
+        span.depth = pixelInfo->depth + RCL_abs(verticalOffset) *
+          RCL_VERTICAL_DEPTH_MULTIPLY + span.depthStep;
+      }
+      else
+      {
+        span.depth = pixelInfo->depth;
+        span.depthStep = 0;
+      }
+
+      RCL_SPAN_FUNCTION(pixelInfo,&span);
+
+      // leave the pixel info as the per-pixel loop would
+      pixelInfo->position.y = span.start + (span.length - 1) * increment;
+
+      if (computeDepth)
+        pixelInfo->depth =
+          RCL_zeroClamp(span.depth + (span.length - 1) * span.depthStep);
+    }
+
+    return limit;
+  }
+#endif
+
   if (computeDepth) // branch early
   {
     if (!computeCoords)
@@ -1140,6 +1591,59 @@ static inline int16_t _RCL_drawHorizontalColumn(
   return limit;
 }
 
+#if RCL_RECIPROCAL_DIVISION
+/// Divisor with its precomputed reciprocal, see _RCL_divideByReciprocal.
+typedef struct
+{
+  RCL_Unit divisor;
+  uint32_t reciprocal; ///< (2^32 - 1) / divisor, 0 if divisor isn't positive
+} _RCL_Reciprocal;
+
+uint32_t _RCL_reciprocalTable[RCL_RECIPROCAL_TABLE_SIZE] = {0};
+
+static inline _RCL_Reciprocal _RCL_makeReciprocal(RCL_Unit divisor)
+{
+  _RCL_Reciprocal result;
+
+  result.divisor = divisor;
+  result.reciprocal = divisor > 0 ? 0xffffffff / ((uint32_t) divisor) : 0;
+
+  return result;
+}
+
+/// Fills the reciprocal table, done before rendering (not in the columns).
+static inline void _RCL_initReciprocalTable()
+{
+  if (_RCL_reciprocalTable[1] != 0)
+    return;
+
+  for (uint16_t i = RCL_RECIPROCAL_TABLE_SIZE - 1; i > 0; --i)
+    _RCL_reciprocalTable[i] = 0xffffffff / i;
+}
+
+/**
+  Computes value / divisor exactly like the division operator does (i.e.
+  rounding towards zero) but with a multiplication. The estimate from the
+  rounded down reciprocal is smaller by at most one, which is fixed up.
+*/
+static inline RCL_Unit _RCL_divideByReciprocal(RCL_Unit value,
+  _RCL_Reciprocal divisor)
+{
+  if (divisor.reciprocal == 0)
+    return value / divisor.divisor;
+
+  uint32_t absValue = value >= 0 ? (uint32_t) value : 0 - (uint32_t) value;
+
+  uint32_t result =
+    (((uint64_t) absValue) * divisor.reciprocal) >> 32;
+
+  if (absValue - result * divisor.divisor >= (uint32_t) divisor.divisor)
+    result++;
+
+  return value >= 0 ? ((RCL_Unit) result) : -1 * ((RCL_Unit) result);
+}
+#endif
+
 /// Helper for drawing walls. Returns the last drawn pixel position.
 static inline int16_t _RCL_drawWall(
   RCL_Unit yCurrent,
@@ -1167,14 +1671,28 @@ static inline int16_t _RCL_drawWall(
   RCL_Unit heightScaled = height * RCL_TEXTURE_INTERPOLATION_SCALE;
   _RCL_UNUSED(heightScaled);
 
+#if RCL_RECIPROCAL_DIVISION
+  _RCL_Reciprocal wallLengthReciprocal;
+
+  wallLengthReciprocal.divisor = wallLength;
+  wallLengthReciprocal.reciprocal = wallLength < RCL_RECIPROCAL_TABLE_SIZE ?
+    _RCL_reciprocalTable[wallLength] : 0;
+
+  #define DIVIDE(a) _RCL_divideByReciprocal(a,wallLengthReciprocal)
+#else
+  #define DIVIDE(a) ((a) / wallLength)
+#endif
+
   RCL_Unit coordStepScaled = RCL_COMPUTE_WALL_TEXCOORDS ?
 #if RCL_TEXTURE_VERTICAL_STRETCH == 1
-    ((RCL_UNITS_PER_SQUARE * RCL_TEXTURE_INTERPOLATION_SCALE) / wallLength)
+    DIVIDE(RCL_UNITS_PER_SQUARE * RCL_TEXTURE_INTERPOLATION_SCALE)
 #else
-    (heightScaled / wallLength)
+    DIVIDE(heightScaled)
 #endif
     : 0;
 
+  #undef DIVIDE
+
   pixelInfo->texCoords.y = RCL_COMPUTE_WALL_TEXCOORDS ?
     (wallPosition * coordStepScaled) : 0;
 
@@ -1197,6 +1715,37 @@ static inline int16_t _RCL_drawWall(
 
   RCL_Unit textureCoordScaled = pixelInfo->texCoords.y;
 
+#ifdef RCL_SPAN_FUNCTION
+  RCL_SpanInfo span;
+
+  span.length = increment == -1 ? yCurrent - limit : limit - yCurrent;
+
+  if (span.length > 0)
+  {
+    span.start = yCurrent + increment;
+    span.increment = increment;
+    span.depth = pixelInfo->depth;
+    span.depthStep = 0;
+
+#if RCL_COMPUTE_WALL_TEXCOORDS == 1
+    span.texCoordY = textureCoordScaled;
+    span.texCoordYStep = coordStepScaled;
+#else
+    span.texCoordY = pixelInfo->texCoords.y * RCL_TEXTURE_INTERPOLATION_SCALE;
+    span.texCoordYStep = 0;
+#endif
+
+    RCL_SPAN_FUNCTION(pixelInfo,&span);
+
+    // leave the pixel info as the per-pixel loop would
+    pixelInfo->position.y = span.start + (span.length - 1) * increment;
+
+#if RCL_COMPUTE_WALL_TEXCOORDS == 1
+    pixelInfo->texCoords.y = (span.texCoordY + (span.length - 1) *
+      span.texCoordYStep) / RCL_TEXTURE_INTERPOLATION_SCALE;
+#endif
+  }
+#else
   for (RCL_Unit i = yCurrent + increment; 
        increment == -1 ? i >= limit : i <= limit; // TODO: is efficient?
        i += increment)
@@ -1212,6 +1761,7 @@ static inline int16_t _RCL_drawWall(
 
     RCL_PIXEL_FUNCTION(pixelInfo);
   }
+#endif
 
   return limit;
 }
@@ -1232,9 +1782,26 @@ static inline void _RCL_makeInfiniteHit(RCL_HitResult *hit, RCL_Ray *ray)
   hit->type = 0;
 }
 
-void _RCL_columnFunctionComplex(RCL_HitResult *hits, uint16_t hitCount, uint16_t x,
-  RCL_Ray ray)
+/**
+  Renders one column for RCL_renderComplex. Unlike other column functions this
+  casts the ray itself and only as far as needed: hits are taken one at a time
+  and with RCL_COLUMN_EARLY_OUT the ray is stopped once the floor and ceiling
+  fronts have met, as nothing further along the ray can be seen then.
+*/
+#if RCL_RAY_PACKET_SIZE > 0
+void _RCL_columnFunctionComplex(uint16_t x, _RCL_RayPacket *packet,
+  uint8_t lane)
+{
+  RCL_Ray ray = packet->ray[lane];
+#else
+void _RCL_columnFunctionComplex(uint16_t x, RCL_Ray ray)
 {
+  _RCL_RayState rayState;
+  _RCL_initRayState(&rayState,ray,_RCL_floorCeilFunction);
+#endif
+
+  uint16_t hitCount = 0;
+
   // last written Y position, can never go backwards
   RCL_Unit fPosY = _RCL_camera.resolution.y;
   RCL_Unit cPosY = -1;
@@ -1251,11 +1818,20 @@ void _RCL_columnFunctionComplex(RCL_HitResult *hits, uint16_t hitCount, uint16_t
   p.texCoords.y = 0;
 
   // we'll be simulatenously drawing the floor and the ceiling now  
-  for (RCL_Unit j = 0; j <= hitCount; ++j)
-  {                    // ^ = add extra iteration for horizon plane
-    int8_t drawingHorizon = j == hitCount;
-
+  while (1)
+  {
     RCL_HitResult hit;
+
+    // after the last hit do an extra iteration for horizon plane
+    int8_t drawingHorizon = hitCount >= _RCL_rayConstraints.maxHits ||
+#if RCL_RAY_PACKET_SIZE > 0
+      !_RCL_nextPacketHit(packet,lane,_RCL_floorCeilFunction,
+        _RCL_typeFunction,_RCL_rayConstraints.maxSteps,&hit);
+#else
+      !_RCL_nextRayHit(&rayState,_RCL_floorCeilFunction,_RCL_typeFunction,
+        _RCL_rayConstraints.maxSteps,&hit);
+#endif
+
     RCL_Unit distance = 1;
 
     RCL_Unit fWallHeight = 0, cWallHeight = 0;
@@ -1265,30 +1841,43 @@ void _RCL_columnFunctionComplex(RCL_HitResult *hits, uint16_t hitCount, uint16_t
 
     if (!drawingHorizon)
     {
-      hit = hits[j];
+      hitCount++;
       distance = RCL_nonZero(hit.distance); 
       p.hit = hit;
 
+#if RCL_RECIPROCAL_DIVISION
+      // all projections of this hit divide by the same number
+      _RCL_Reciprocal perspective = _RCL_makeReciprocal(RCL_nonZero(
+        (_RCL_fovCorrectionFactors[1] * distance) / RCL_UNITS_PER_SQUARE));
+
+  #define PERSPECTIVE(size) _RCL_divideByReciprocal(\
+    (size) * RCL_UNITS_PER_SQUARE,perspective)
+#else
+  #define PERSPECTIVE(size) RCL_perspectiveScaleVertical(size,distance)
+#endif
+
       fWallHeight = _RCL_floorFunction(hit.square.x,hit.square.y);
       fZ2World = fWallHeight - _RCL_camera.height;
-      fZ1Screen = _RCL_middleRow - RCL_perspectiveScaleVertical(
+      fZ1Screen = _RCL_middleRow - PERSPECTIVE(
         (fZ1World * _RCL_camera.resolution.y) /
-        RCL_UNITS_PER_SQUARE,distance);
-      fZ2Screen = _RCL_middleRow - RCL_perspectiveScaleVertical(
+        RCL_UNITS_PER_SQUARE);
+      fZ2Screen = _RCL_middleRow - PERSPECTIVE(
         (fZ2World * _RCL_camera.resolution.y) /
-        RCL_UNITS_PER_SQUARE,distance);
+        RCL_UNITS_PER_SQUARE);
 
       if (_RCL_ceilFunction != 0)
       {
         cWallHeight = _RCL_ceilFunction(hit.square.x,hit.square.y);
         cZ2World = cWallHeight - _RCL_camera.height;
-        cZ1Screen = _RCL_middleRow - RCL_perspectiveScaleVertical(
+        cZ1Screen = _RCL_middleRow - PERSPECTIVE(
           (cZ1World * _RCL_camera.resolution.y) /
-          RCL_UNITS_PER_SQUARE,distance);
-        cZ2Screen = _RCL_middleRow - RCL_perspectiveScaleVertical(
+          RCL_UNITS_PER_SQUARE);
+        cZ2Screen = _RCL_middleRow - PERSPECTIVE(
           (cZ2World * _RCL_camera.resolution.y) /
-          RCL_UNITS_PER_SQUARE,distance);
+          RCL_UNITS_PER_SQUARE);
       }
+
+  #undef PERSPECTIVE
     }
     else
     {
@@ -1397,6 +1986,13 @@ void _RCL_columnFunctionComplex(RCL_HitResult *hits, uint16_t hitCount, uint16_t
         cZ1World = cZ2World; // for the next iteration
       }              // ^ puposfully allow outside screen bounds here 
     }
+    else
+      break;
+
+#if RCL_COLUMN_EARLY_OUT
+    if (fPosY <= cPosY + 1)
+      break; // no pixels left between the fronts, the rest is hidden
+#endif
   }
 }
 
@@ -1562,10 +2158,16 @@ static inline void _RCL_precomputeFloorDistances(RCL_Camera camera,
              RCL_abs(i - _RCL_middleRow));
 }
 
-void RCL_renderComplex(RCL_Camera cam, RCL_ArrayFunction floorHeightFunc,
-  RCL_ArrayFunction ceilingHeightFunc, RCL_ArrayFunction typeFunction,
-  RCL_RayConstraints constraints)
+/**
+  Sets up the library state for rendering a complex view, which is then only
+  read while rendering the columns.
+*/
+static inline void _RCL_setupComplex(RCL_Camera cam,
+  RCL_ArrayFunction floorHeightFunc, RCL_ArrayFunction ceilingHeightFunc,
+  RCL_ArrayFunction typeFunction, RCL_RayConstraints constraints)
 {
+  _RCL_typeFunction = typeFunction;
+  _RCL_rayConstraints = constraints;
   _RCL_floorFunction = floorHeightFunc;
   _RCL_ceilFunction = ceilingHeightFunc;
   _RCL_camera = cam;
@@ -1591,14 +2193,67 @@ void RCL_renderComplex(RCL_Camera cam, RCL_ArrayFunction floorHeightFunc,
 
   _RCL_horizontalDepthStep = RCL_HORIZON_DEPTH / cam.resolution.y; 
 
+  if (_RCL_fovCorrectionFactors[1] == 0) // don't leave this for the columns
+    _RCL_fovCorrectionFactors[1] = _RCL_fovCorrectionFactor(RCL_VERTICAL_FOV);
+
+#if RCL_RECIPROCAL_DIVISION
+  _RCL_initReciprocalTable();
+#endif
+}
+
+void RCL_renderComplex(RCL_Camera cam, RCL_ArrayFunction floorHeightFunc,
+  RCL_ArrayFunction ceilingHeightFunc, RCL_ArrayFunction typeFunction,
+  RCL_RayConstraints constraints)
+{
+  _RCL_setupComplex(cam,floorHeightFunc,ceilingHeightFunc,typeFunction,
+    constraints);
+
 #if RCL_COMPUTE_FLOOR_TEXCOORDS == 1
   RCL_Unit floorPixelDistances[cam.resolution.y];
   _RCL_precomputeFloorDistances(cam,floorPixelDistances,0);
   _RCL_floorPixelDistances = floorPixelDistances; // pass to column function
 #endif
 
-  RCL_castRaysMultiHit(cam,_RCL_floorCeilFunction,typeFunction,
-    _RCL_columnFunctionComplex,constraints);
+  RCL_renderComplexColumns(0,cam.resolution.x);
+}
+
+void RCL_renderComplexBegin(RCL_Camera cam, RCL_ArrayFunction floorHeightFunc,
+  RCL_ArrayFunction ceilingHeightFunc, RCL_ArrayFunction typeFunction,
+  RCL_RayConstraints constraints)
+{
+  _RCL_setupComplex(cam,floorHeightFunc,ceilingHeightFunc,typeFunction,
+    constraints);
+}
+
+void RCL_renderComplexColumns(int16_t fromX, int16_t toX)
+{
+  RCL_Vector2D dir1, dirDiff;
+
+  _RCL_columnRays(_RCL_camera,&dir1,&dirDiff);
+
+#if RCL_RAY_PACKET_SIZE > 0
+  _RCL_RayPacket packet;
+
+  for (int16_t i = fromX; i < toX; i += RCL_RAY_PACKET_SIZE)
+  {
+    RCL_Ray rays[RCL_RAY_PACKET_SIZE];
+    uint8_t rayCount = RCL_min(RCL_RAY_PACKET_SIZE,toX - i);
+
+    for (uint8_t j = 0; j < rayCount; ++j)
+      rays[j] = _RCL_columnRay(&_RCL_camera,dir1,dirDiff,i + j);
+
+    _RCL_initRayPacket(&packet,rays,rayCount,_RCL_floorCeilFunction);
+
+    for (uint8_t j = 0; j < rayCount; ++j)
+    {
+      _RCL_columnFunctionComplex(i + j,&packet,j);
+      packet.running[j] = 0; // the column is done, stop stepping its ray
+    }
+  }
+#else
+  for (int16_t i = fromX; i < toX; ++i)
+    _RCL_columnFunctionComplex(i,_RCL_columnRay(&_RCL_camera,dir1,dirDiff,i));
+#endif
 }
 
 void RCL_renderSimple(RCL_Camera cam, RCL_ArrayFunction floorHeightFunc,
@@ -1617,6 +2272,10 @@ void RCL_renderSimple(RCL_Camera cam, RCL_ArrayFunction floorHeightFunc,
 
   _RCL_horizontalDepthStep = RCL_HORIZON_DEPTH / cam.resolution.y; 
 
+#if RCL_RECIPROCAL_DIVISION
+  _RCL_initReciprocalTable();
+#endif
+
   constraints.maxHits = 
     _RCL_rollFunction == 0 ?
       1 : // no door => 1 hit is enough 
@@ -117,6 +117,26 @@
   #define SFG_TEXTURE_DISTANCE 100000
 #endif
 
+/**
+  Whether textures of the current level (walls, door and background) should be
+  decoded to RAM when the level starts so that drawing them is just a simple
+  array access. This is faster but needs about 9 KB of RAM.
+*/
+#ifndef SFG_CACHE_TEXTURES
+  #define SFG_CACHE_TEXTURES 1
+#endif
+
+/**
+  Whether the level background should be scaled to the view height in RAM when
+  the level starts and mapped to view columns once per frame, so that drawing a
+  background pixel is just a simple array access. Needs SFG_TEXTURE_SIZE *
+  SFG_GAME_RESOLUTION_Y bytes of RAM (about 4 KB at 120 pixels vertical
+  resolution). Has no effect with background blur (SFG_BACKGROUND_BLUR).
+*/
+#ifndef SFG_CACHE_BACKGROUND
+  #define SFG_CACHE_BACKGROUND 1
+#endif
+
 /**
   How many times the screen resolution will be divided (how many times a game
   pixel will be bigger than the screen pixel).
@@ -214,6 +234,16 @@
   #define SFG_RAYCASTING_SUBSAMPLE 1
 #endif
 
+/**
+  Into how many parts (ranges of columns) the 3D view should be split for
+  rendering. With values above 1 the frontend has to implement
+  SFG_renderViewParallel() which can render the parts in parallel, e.g. on
+  multiple CPU cores.
+*/
+#ifndef SFG_RENDERING_THREADS
+  #define SFG_RENDERING_THREADS 1
+#endif
+
 /**
   Enables or disables fog (darkness) due to distance. Recommended to keep on
   for good look, but can be turned off for performance.
@@ -230,6 +260,177 @@
   #define SFG_DIMINISH_SPRITES 1
 #endif
 
+/**
+  Whether fog and shadow shading should be done with precomputed lookup tables
+  (a table of shaded colors and a table of dithered fog values) instead of
+  computing them for each pixel. This is faster but needs about 4 KB of RAM.
+*/
+#ifndef SFG_SHADE_TABLES
+  #define SFG_SHADE_TABLES 1
+#endif
+
+/**
+  Whether the raycasting library should hand wall pixels and untextured floor
+  and ceiling pixels to the game in vertical runs (see RCL_SPAN_FUNCTION)
+  instead of one by one. The pixels are the same, but runs are faster as the
+  texture and shading are selected once per run.
+*/
+#ifndef SFG_VIEW_SPANS
+  #define SFG_VIEW_SPANS 1
+#endif
+
+/**
+  Whether opacity masks of sprite columns should be computed at start so that
+  sprite drawing only visits opaque texels and skips transparent columns. This
+  is faster, especially with many sprites on screen, but needs about 4.5 KB of
+  RAM.
+*/
+#ifndef SFG_SPRITE_COLUMN_MASKS
+  #define SFG_SPRITE_COLUMN_MASKS 1
+#endif
+
+/**
+  Whether the 3D view should fill a depth buffer with one byte per raycasting
+  column and row (SFG_GAME_RESOLUTION_X / SFG_RAYCASTING_SUBSAMPLE *
+  SFG_GAME_RESOLUTION_Y bytes of RAM, e.g. 9.6 KB at 160x120 with subsample
+  2) against which sprites are tested pixel by pixel. Sprites are then
+  correctly hidden (also partially) behind walls and no visibility rays are
+  cast for drawing them. Otherwise a sprite is drawn whole if a ray from the
+  player reaches it (see SFG_VISIBILITY_CACHE).
+*/
+#ifndef SFG_DEPTH_BUFFER
+  #define SFG_DEPTH_BUFFER 0
+#endif
+
+/**
+  If on, the number of sprite pixels that weren't drawn because nearer sprites
+  already cover them (sprites are drawn front to back) is counted in
+  SFG_spriteOverdrawAvoided, e.g. for tuning sprite drawing.
+*/
+#ifndef SFG_COUNT_SPRITE_OVERDRAW
+  #define SFG_COUNT_SPRITE_OVERDRAW 0
+#endif
+
+/**
+  Whether results of sprite visibility checks (line of sight rays between the
+  player and monsters, items and projectiles) should be cached. Entries are
+  keyed by the exact camera and sprite positions and heights, so they are
+  shared by the drawing, monster AI and autoaim and hit for as long as neither
+  moves. An entry is dropped when a door, elevator or squeezer moves in the
+  area its ray can pass, so the results are always the same as without the
+  cache. Needs about 1 KB of RAM.
+*/
+#ifndef SFG_VISIBILITY_CACHE
+  #define SFG_VISIBILITY_CACHE 1
+#endif
+
+/**
+  Whether a sight grid (a potentially visible set) should be kept for the
+  player's square. For each map square it says how high a line of sight from
+  the player has to be to possibly get there (doors count as open, elevators as
+  down), so that sprites that can't be visible are rejected without casting a
+  ray. It is recomputed when the player enters another square and needs about
+  12 KB of RAM.
+*/
+#ifndef SFG_SIGHT_GRID
+  #define SFG_SIGHT_GRID 1
+#endif
+
+/**
+  Whether monsters should be kept in a coarse grid of map areas (each area a
+  64 bit set of the monsters in it) so that projectile and explosion hits only
+  test monsters in nearby areas instead of all of them. Needs 512 bytes of
+  RAM.
+*/
+#ifndef SFG_MONSTER_GRID
+  #define SFG_MONSTER_GRID 1
+#endif
+
+/**
+  Whether melee and exploding monsters should walk along a flow field, i.e. a
+  map of walking distances of all squares to the player's square (closed doors
+  and squeezers that are down block it, elevators count over their whole floor
+  range), instead of straight towards the player, so that they get around walls
+  and pits. The field is shared by all monsters and recomputed when the player
+  enters another square or a door or squeezer opens or closes. Needs 4 KB of
+  RAM (8 KB without SFG_SIGHT_GRID).
+*/
+#ifndef SFG_MONSTER_FLOW_FIELD
+  #define SFG_MONSTER_FLOW_FIELD 1
+#endif
+
+/**
+  Whether the 3D view (walls, floors and sprites, without the weapon and HUD)
+  should be reused from the previous frame when nothing that affects it (the
+  camera, square heights, sprites) has changed. This saves most of the drawing
+  time when the player stands still, but the frontend has to implement
+  SFG_saveView() and SFG_restoreView() which need a copy of the screen.
+*/
+#ifndef SFG_VIEW_REUSE
+  #define SFG_VIEW_REUSE 0
+#endif
+
+/**
+  Whether rendering quality should be adjusted at runtime to keep the frame
+  rate: when drawing frames takes too long, the texture distance, the number
+  of ray steps and finally the horizontal resolution are lowered in several
+  quality levels (and raised again when there's time to spare). The best level
+  is given by SFG_TEXTURE_DISTANCE, SFG_RAYCASTING_MAX_STEPS and
+  SFG_RAYCASTING_SUBSAMPLE. See also SFG_setTargetFPS().
+*/
+#ifndef SFG_QUALITY_GOVERNOR
+  #define SFG_QUALITY_GOVERNOR 0
+#endif
+
+/**
+  For SFG_QUALITY_GOVERNOR, quality is lowered when the average time of
+  computing a frame gets above this percentage of the target frame time.
+*/
+#ifndef SFG_QUALITY_LOWER_PERCENT
+  #define SFG_QUALITY_LOWER_PERCENT 95
+#endif
+
+/**
+  For SFG_QUALITY_GOVERNOR, quality is raised when the average time of
+  computing a frame gets below this percentage of the target frame time. Keep
+  it well below SFG_QUALITY_LOWER_PERCENT so that the levels don't oscillate.
+*/
+#ifndef SFG_QUALITY_RAISE_PERCENT
+  #define SFG_QUALITY_RAISE_PERCENT 65
+#endif
+
+/**
+  For SFG_QUALITY_GOVERNOR, minimum number of frames between two changes of
+  the quality level, so that the average frame time can settle.
+*/
+#ifndef SFG_QUALITY_HOLD_FRAMES
+  #define SFG_QUALITY_HOLD_FRAMES 30
+#endif
+
+/**
+  For SFG_QUALITY_GOVERNOR, texture distance (in RCL_Units) of the first
+  lowered quality level, each further level halves it.
+*/
+#ifndef SFG_QUALITY_TEXTURE_DISTANCE
+  #define SFG_QUALITY_TEXTURE_DISTANCE (8 * 1024)
+#endif
+
+/**
+  For SFG_QUALITY_GOVERNOR, the number of ray steps at the lowest quality
+  level.
+*/
+#ifndef SFG_QUALITY_MIN_STEPS
+  #define SFG_QUALITY_MIN_STEPS (SFG_RAYCASTING_MAX_STEPS / 2)
+#endif
+
+/**
+  For SFG_QUALITY_GOVERNOR, the horizontal subsample at the lowest quality
+  level. This number should be a divisor of SFG_SCREEN_RESOLUTION_X!
+*/
+#ifndef SFG_QUALITY_MAX_SUBSAMPLE
+  #define SFG_QUALITY_MAX_SUBSAMPLE (SFG_RAYCASTING_SUBSAMPLE * 2)
+#endif
+
 /**
   How quick player head bob is, 1024 meaning once per second. 0 Means turn off
   head bob.
@@ -309,15 +510,6 @@
   #define SFG_HUD_ITEM_TAKEN_INDICATION_COLOR 207
 #endif
 
-/**
-  How many element (items, monsters, ...) distances will be checked per frame
-  for distance. Higher value may decrease performance a tiny bit, but things
-  will react more quickly and appear less "out of thin air".
-*/
-#ifndef SFG_ELEMENT_DISTANCES_CHECKED_PER_FRAME
-  #define SFG_ELEMENT_DISTANCES_CHECKED_PER_FRAME 8
-#endif
-
 /**
   Maximum distance at which sound effects (SFX) will be played. The SFX volume
   will gradually drop towards this distance.
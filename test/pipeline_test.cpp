@@ -0,0 +1,148 @@
+/*
+  Runs the Anarch context's frame pipeline against a stub display whose commit
+  takes as long as an SPI transfer. Checks that every frame reaches the display
+  whole and in order, that another loop listener drawing to the display never
+  overlaps a push, and that pushing overlaps with drawing the next frame.
+*/
+
+#include <stdio.h>
+#include "Anarch.h"
+
+#define WIDTH 160
+#define HEIGHT 120
+#define FRAMES 60
+#define RENDER_MS 20  // time the game takes to simulate and draw a frame
+#define COMMIT_MS 15  // time the display takes to transfer a frame
+#define POPUP_MS 2    // time the other loop listener draws to the display
+
+#define POPUP_COLOR 0xffff
+
+Anarch* game;
+uint8_t* frameBuffer;
+uint32_t framesDrawn = 0;
+
+uint8_t frameColor(uint32_t frame){
+	return 1 + frame % 200;
+}
+
+/**
+ * Checks what would be sent to the panel at the start and at the end of a
+ * transfer: the base sprite has to hold exactly the next frame.
+ */
+class StubDisplay : public Display{
+public:
+	StubDisplay() : Display(WIDTH, HEIGHT + 8){ }
+
+	void commit() override{
+		checkFrame();
+		Display::commit();
+		checkFrame();
+		framesPushed++;
+	}
+
+	uint32_t framesPushed = 0;
+	uint32_t errors = 0;
+
+private:
+	void checkFrame(){
+		const uint16_t* pixels = (const uint16_t*) getBaseSprite()->getBuffer();
+		const uint16_t expected = frameColor(framesPushed) * 257;
+
+		for(int y = 0; y < HEIGHT; y++){
+			for(int x = 0; x < WIDTH; x++){
+				if(pixels[y * getBaseSprite()->width() + x] != expected){
+					printf("frame %u: pixel %d,%d is %04x instead of %04x\n", framesPushed, x, y,
+						   pixels[y * getBaseSprite()->width() + x], expected);
+					errors++;
+					return;
+				}
+			}
+		}
+	}
+};
+
+/**
+ * Stands for a popup or any other loop listener that draws to the display.
+ */
+class Popup : public LoopListener{
+public:
+	Popup(Display* display) : display(display){ }
+
+	void loop(uint micros) override{
+		uint16_t* pixels = (uint16_t*) display->getBaseSprite()->getBuffer();
+		uint32_t start = millis();
+
+		while(millis() - start < POPUP_MS){
+			pixels[(start + x++) % (WIDTH * HEIGHT)] = POPUP_COLOR;
+		}
+	}
+
+private:
+	Display* display;
+	uint32_t x = 0;
+};
+
+uint8_t SFG_mainLoopBody(){
+	if(framesDrawn >= FRAMES){
+		return 0;
+	}
+
+	// draw in two halves so that a frame buffer still being pushed would show
+	memset(frameBuffer, frameColor(framesDrawn), WIDTH * HEIGHT / 2);
+	delay(RENDER_MS);
+	memset(frameBuffer + WIDTH * HEIGHT / 2, frameColor(framesDrawn), WIDTH * HEIGHT / 2);
+
+	framesDrawn++;
+	frameBuffer = game->submitFrame();
+
+	return 1;
+}
+
+int main(){
+	StubDisplay display;
+	display.commitTimeMs = COMMIT_MS;
+
+	game = new Anarch(&display, WIDTH, HEIGHT);
+	frameBuffer = game->getFrameBuffer();
+
+	uint16_t palette[256];
+
+	for(int i = 0; i < 256; i++){
+		palette[i] = i * 257; // the same with the bytes swapped
+	}
+
+	game->setPalette(palette);
+
+	Popup popup(&display);
+	LoopManager::addListener(&popup);
+
+	game->start();
+
+	uint32_t start = millis();
+
+	while(framesDrawn < FRAMES){
+		LoopManager::loop();
+	}
+
+	game->stop(); // pushes the last frame
+	uint32_t time = millis() - start;
+
+	delete game;
+
+	const uint32_t serialTime = FRAMES * (RENDER_MS + POPUP_MS + COMMIT_MS);
+
+	printf("%u frames pushed in %u ms (%u ms without the pipeline), %u errors\n", display.framesPushed, time,
+		   serialTime, display.errors);
+
+	if(display.framesPushed != FRAMES || display.errors != 0){
+		return 1;
+	}
+
+	// most of the transfer time has to be hidden behind drawing
+	if(time > FRAMES * (RENDER_MS + POPUP_MS) + FRAMES * COMMIT_MS / 4){
+		printf("pushing doesn't overlap with drawing\n");
+		return 1;
+	}
+
+	return 0;
+}
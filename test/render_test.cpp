@@ -0,0 +1,280 @@
+/*
+  Host frontend that renders fixed camera poses in all levels, then plays each
+  level for a while with scripted input, and prints a hash of the frames. The
+  Makefile builds it with different rendering settings and compares the
+  output, as the settings it tries must all draw exactly the same pixels.
+
+  With SFG_RENDERING_THREADS above 1 the view parts are rendered by a pool of
+  POSIX threads.
+
+  Built with RENDER_BENCHMARK (and RCL_COUNT_RAY_STEPS) it instead renders the
+  poses of each level repeatedly and prints the ray steps and array lookups
+  made per frame and how long a frame took.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// the same settings as on the ByteBoi, except the ones compared by the tests
+
+#define SFG_AVR 1
+#define SFG_SCREEN_RESOLUTION_X 160
+#define SFG_SCREEN_RESOLUTION_Y 120
+#define SFG_FPS 30
+#define SFG_RAYCASTING_MAX_STEPS 60
+#define SFG_RAYCASTING_SUBSAMPLE 2
+#define SFG_RAYCASTING_MAX_HITS 15
+#define SFG_DIMINISH_SPRITES 1
+#define SFG_DITHERED_SHADOW 1
+#define SFG_CAN_EXIT 1
+
+#ifndef SFG_VIEW_REUSE
+  #define SFG_VIEW_REUSE 1
+#endif
+
+#ifndef RCL_RECIPROCAL_DIVISION
+  #define RCL_RECIPROCAL_DIVISION 1
+#endif
+
+#include "game.h"
+
+#define POSE_SQUARES 6    // squares with monsters to put the camera in
+#define PLAY_FRAMES 300
+#define BENCHMARK_REPEATS 100
+
+uint8_t frameBuffer[SFG_SCREEN_RESOLUTION_X * SFG_SCREEN_RESOLUTION_Y];
+uint8_t savedView[SFG_SCREEN_RESOLUTION_X * SFG_SCREEN_RESOLUTION_Y];
+uint8_t keys[SFG_KEY_COUNT];
+uint32_t timeMs = 0;
+
+static inline void SFG_setPixel(uint16_t x, uint16_t y, uint8_t colorIndex)
+{
+  frameBuffer[y * SFG_SCREEN_RESOLUTION_X + x] = colorIndex;
+}
+
+uint32_t SFG_getTimeMs() { return timeMs; }
+void SFG_sleepMs(uint16_t timeMs) { }
+int8_t SFG_keyPressed(uint8_t key) { return keys[key]; }
+void SFG_getMouseOffset(int16_t *x, int16_t *y) { }
+void SFG_setMusic(uint8_t value) { }
+void SFG_save(uint8_t data[SFG_SAVE_SIZE]) { }
+uint8_t SFG_load(uint8_t data[SFG_SAVE_SIZE]) { return 0; }
+void SFG_processEvent(uint8_t event, uint8_t data) { }
+void SFG_playSound(uint8_t soundIndex, uint8_t volume) { }
+
+void SFG_saveView()
+{
+  memcpy(savedView,frameBuffer,sizeof(frameBuffer));
+}
+
+void SFG_restoreView()
+{
+  memcpy(frameBuffer,savedView,sizeof(frameBuffer));
+}
+
+#if SFG_RENDERING_THREADS > 1
+#include <pthread.h>
+
+pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t poolStart = PTHREAD_COND_INITIALIZER;
+pthread_cond_t poolDone = PTHREAD_COND_INITIALIZER;
+uint32_t poolFrame = 0;  // incremented to let the workers render a frame
+uint8_t poolPartsLeft = 0;
+
+void *poolWorker(void *arg)
+{
+  uint8_t part = (uint8_t) (uintptr_t) arg;
+  uint32_t frame = 0;
+
+  pthread_mutex_lock(&poolMutex);
+
+  while (1)
+  {
+    while (poolFrame == frame)
+      pthread_cond_wait(&poolStart,&poolMutex);
+
+    frame = poolFrame;
+    pthread_mutex_unlock(&poolMutex);
+
+    SFG_renderViewPart(part);
+
+    pthread_mutex_lock(&poolMutex);
+
+    poolPartsLeft--;
+
+    if (poolPartsLeft == 0)
+      pthread_cond_signal(&poolDone);
+  }
+
+  return 0;
+}
+
+void startPool()
+{
+  for (uint8_t i = 1; i < SFG_RENDERING_THREADS; ++i)
+  {
+    pthread_t thread;
+    pthread_create(&thread,0,poolWorker,(void *) (uintptr_t) i);
+    pthread_detach(thread);
+  }
+}
+
+void SFG_renderViewParallel()
+{
+  pthread_mutex_lock(&poolMutex);
+  poolPartsLeft = SFG_RENDERING_THREADS - 1;
+  poolFrame++;
+  pthread_cond_broadcast(&poolStart);
+  pthread_mutex_unlock(&poolMutex);
+
+  SFG_renderViewPart(0);
+
+  pthread_mutex_lock(&poolMutex);
+
+  while (poolPartsLeft != 0)
+    pthread_cond_wait(&poolDone,&poolMutex);
+
+  pthread_mutex_unlock(&poolMutex);
+}
+#endif
+
+uint32_t hashFrame()
+{
+  uint32_t hash = 2166136261u;
+
+  for (uint32_t i = 0; i < sizeof(frameBuffer); ++i)
+    hash = (hash ^ frameBuffer[i]) * 16777619u;
+
+  return hash;
+}
+
+void placeCamera(uint8_t x, uint8_t y, RCL_Unit direction)
+{
+  SFG_player.camera.position.x = x * RCL_UNITS_PER_SQUARE +
+    RCL_UNITS_PER_SQUARE / 2;
+  SFG_player.camera.position.y = y * RCL_UNITS_PER_SQUARE +
+    RCL_UNITS_PER_SQUARE / 2;
+  SFG_player.camera.height = SFG_floorHeightAt(x,y) +
+    RCL_CAMERA_COLL_HEIGHT_BELOW;
+  SFG_player.camera.direction = direction;
+  SFG_player.squarePosition[0] = x;
+  SFG_player.squarePosition[1] = y;
+
+  SFG_recomputePLayerDirection();
+}
+
+uint64_t timeUs()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return t.tv_sec * 1000000ull + t.tv_nsec / 1000;
+}
+
+void renderPoses(uint8_t level, uint8_t repeats)
+{
+  SFG_setAndInitLevel(level);
+  SFG_setGameState(SFG_GAME_STATE_PLAYING);
+
+  uint8_t squares[POSE_SQUARES + 1][2];
+
+  squares[0][0] = SFG_currentLevel.levelPointer->playerStart[0];
+  squares[0][1] = SFG_currentLevel.levelPointer->playerStart[1];
+
+  uint8_t squareCount = 1;
+
+  for (uint8_t i = 0; i < POSE_SQUARES &&
+    i < SFG_currentLevel.monsterRecordCount; ++i)
+  {
+    SFG_MonsterRecord *monster = SFG_currentLevel.monsterRecords +
+      (i * SFG_currentLevel.monsterRecordCount) / POSE_SQUARES;
+
+    squares[squareCount][0] = monster->coords[0] / 4;
+    squares[squareCount][1] = monster->coords[1] / 4;
+    squareCount++;
+  }
+
+#ifdef RENDER_BENCHMARK
+  RCL_rayStepCount = 0;
+  RCL_rayLookupCount = 0;
+  uint64_t start = timeUs();
+#endif
+
+  for (uint8_t r = 0; r < repeats; ++r)
+    for (uint8_t i = 0; i < squareCount; ++i)
+      for (uint8_t j = 0; j < 4; ++j)
+      {
+        placeCamera(squares[i][0],squares[i][1],
+          j * (RCL_UNITS_PER_SQUARE / 4) + 100);
+
+        SFG_draw();
+
+#ifndef RENDER_BENCHMARK
+        printf("level %d pose %d/%d: %08x\n",level,i,j,hashFrame());
+#endif
+      }
+
+#ifdef RENDER_BENCHMARK
+  uint64_t time = timeUs() - start;
+  uint32_t frames = repeats * squareCount * 4;
+
+  printf("level %d: %6u steps %6u lookups per frame, %5u us per frame, "
+    "%4u M steps/s\n",level,RCL_rayStepCount / frames,
+    RCL_rayLookupCount / frames,(uint32_t) (time / frames),
+    (uint32_t) (RCL_rayStepCount / RCL_nonZero(time)));
+#endif
+}
+
+void play(uint8_t level)
+{
+  SFG_setAndInitLevel(level);
+
+  uint32_t random = 12345 + level;
+  uint32_t hash = 0;
+
+  for (uint16_t frame = 0; frame < PLAY_FRAMES; ++frame)
+  {
+    if (frame % 15 == 0)
+    {
+      random = random * 1103515245u + 12345u;
+
+      uint32_t r = random >> 8;
+
+      memset(keys,0,sizeof(keys));
+
+      keys[SFG_KEY_UP] = (r & 3) != 0;
+      keys[(r & 16) ? SFG_KEY_LEFT : SFG_KEY_RIGHT] = (r & 32) != 0;
+      keys[SFG_KEY_A] = (r & 64) != 0;
+      keys[SFG_KEY_JUMP] = (r & 0x3000) == 0x3000;
+    }
+
+    timeMs += SFG_MS_PER_FRAME;
+    SFG_mainLoopBody();
+
+    hash = hash * 31 + hashFrame();
+  }
+
+  printf("level %d play: %08x\n",level,hash);
+}
+
+int main()
+{
+#if SFG_RENDERING_THREADS > 1
+  startPool();
+#endif
+
+  SFG_init();
+
+  for (uint8_t level = 0; level < SFG_NUMBER_OF_LEVELS; ++level)
+  {
+#ifdef RENDER_BENCHMARK
+    renderPoses(level,BENCHMARK_REPEATS);
+#else
+    renderPoses(level,1);
+    play(level);
+#endif
+  }
+
+  return 0;
+}
@@ -0,0 +1,26 @@
+/*
+  Minimal Arduino stand-in for building the frontend on a Linux host.
+*/
+
+#ifndef ANARCH_TEST_ARDUINO_H
+#define ANARCH_TEST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef unsigned int uint;
+
+inline uint32_t millis(){
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+inline void delay(uint32_t ms){
+	timespec t = { (time_t) (ms / 1000), (long) (ms % 1000) * 1000000 };
+	nanosleep(&t, nullptr);
+}
+
+#endif
@@ -0,0 +1,22 @@
+/*
+  Host stand-in for the ByteBoi library, game.h only needs the launcher call.
+*/
+
+#ifndef ANARCH_TEST_BYTEBOI_H
+#define ANARCH_TEST_BYTEBOI_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(a) (*(const uint8_t *)(a))
+#define pgm_read_word(a) (*(const uint16_t *)(a))
+#define memcpy_P memcpy
+
+struct ByteBoiImpl{
+	void backToLauncher(){ }
+};
+
+static ByteBoiImpl ByteBoi;
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef ANARCH_TEST_CIRCUITOS_H
+#define ANARCH_TEST_CIRCUITOS_H
+
+#include "Display/Display.h"
+
+#endif
@@ -0,0 +1,40 @@
+/*
+  Stub display for the host: commit() copies the base sprite to a front
+  buffer and takes as long as an SPI transfer would (see commitTimeMs).
+*/
+
+#ifndef ANARCH_TEST_DISPLAY_H
+#define ANARCH_TEST_DISPLAY_H
+
+#include <Arduino.h>
+
+class Sprite{
+public:
+	Sprite(uint16_t width, uint16_t height) : w(width), h(height), buffer(new uint16_t[width * height]()){ }
+	~Sprite(){ delete[] buffer; }
+
+	void* getBuffer(){ return buffer; }
+	uint16_t width() const{ return w; }
+	uint16_t height() const{ return h; }
+
+private:
+	uint16_t w, h;
+	uint16_t* buffer;
+};
+
+class Display{
+public:
+	Display(uint16_t width, uint16_t height) : baseSprite(width, height){ }
+	virtual ~Display(){ }
+
+	Sprite* getBaseSprite(){ return &baseSprite; }
+
+	virtual void commit(){ delay(commitTimeMs); }
+
+	uint32_t commitTimeMs = 0;
+
+private:
+	Sprite baseSprite;
+};
+
+#endif
@@ -0,0 +1 @@
+// nothing of this is used on the host
@@ -0,0 +1,38 @@
+#ifndef ANARCH_TEST_LOOPMANAGER_H
+#define ANARCH_TEST_LOOPMANAGER_H
+
+#include <Arduino.h>
+#include <vector>
+#include <algorithm>
+
+class LoopListener{
+public:
+	virtual ~LoopListener(){ }
+	virtual void loop(uint micros) = 0;
+};
+
+class LoopManager{
+public:
+	static void addListener(LoopListener* listener){ listeners().push_back(listener); }
+
+	static void removeListener(LoopListener* listener){
+		auto& all = listeners();
+		all.erase(std::remove(all.begin(), all.end(), listener), all.end());
+	}
+
+	static void loop(){
+		auto all = listeners();
+
+		for(LoopListener* listener : all){
+			listener->loop(0);
+		}
+	}
+
+private:
+	static std::vector<LoopListener*>& listeners(){
+		static std::vector<LoopListener*> all;
+		return all;
+	}
+};
+
+#endif
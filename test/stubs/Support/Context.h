@@ -0,0 +1,29 @@
+#ifndef ANARCH_TEST_CONTEXT_H
+#define ANARCH_TEST_CONTEXT_H
+
+#include "../Display/Display.h"
+
+class Screen{
+public:
+	Screen(Display& display) : sprite(display.getBaseSprite()->width(), display.getBaseSprite()->height()){ }
+	Sprite* getSprite(){ return &sprite; }
+
+private:
+	Sprite sprite;
+};
+
+class Context{
+public:
+	Context(Display& display) : screen(display){ }
+	virtual ~Context(){ }
+
+	virtual void draw(){ }
+	virtual void start(){ }
+	virtual void stop(){ }
+	void unpack(){ }
+
+protected:
+	Screen screen;
+};
+
+#endif
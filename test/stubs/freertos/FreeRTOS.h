@@ -0,0 +1,24 @@
+/*
+  The part of FreeRTOS the frontend uses, on top of POSIX threads. Tasks are
+  threads (the core they are pinned to is ignored), semaphores are a counter
+  under a mutex.
+*/
+
+#ifndef ANARCH_TEST_FREERTOS_H
+#define ANARCH_TEST_FREERTOS_H
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY ((TickType_t) 0xffffffff)
+
+#define configASSERT(x) assert(x)
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef ANARCH_TEST_SEMPHR_H
+#define ANARCH_TEST_SEMPHR_H
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+struct SemaphoreControl{
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;
+	uint32_t count;
+	bool isMutex;
+	TaskHandle_t holder;
+};
+
+typedef SemaphoreControl* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t _semaphoreCreate(uint32_t count, bool isMutex){
+	SemaphoreHandle_t semaphore = new SemaphoreControl;
+
+	pthread_mutex_init(&semaphore->mutex, nullptr);
+	pthread_cond_init(&semaphore->changed, nullptr);
+	semaphore->count = count;
+	semaphore->isMutex = isMutex;
+	semaphore->holder = nullptr;
+
+	return semaphore;
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary(){
+	return _semaphoreCreate(0, false);
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex(){
+	return _semaphoreCreate(1, true);
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t semaphore){
+	pthread_cond_destroy(&semaphore->changed);
+	pthread_mutex_destroy(&semaphore->mutex);
+	delete semaphore;
+}
+
+inline void _semaphoreUnlock(void* mutex){
+	pthread_mutex_unlock((pthread_mutex_t*) mutex);
+}
+
+/**
+ * Only waiting forever is supported, which is all the frontend does.
+ */
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks){
+	assert(ticks == portMAX_DELAY);
+
+	pthread_mutex_lock(&semaphore->mutex);
+
+	// tasks get deleted while waiting here
+	pthread_cleanup_push(_semaphoreUnlock, &semaphore->mutex);
+
+	while(semaphore->count == 0){
+		pthread_cond_wait(&semaphore->changed, &semaphore->mutex);
+	}
+
+	pthread_cleanup_pop(0);
+
+	semaphore->count--;
+
+	if(semaphore->isMutex){
+		semaphore->holder = xTaskGetCurrentTaskHandle();
+	}
+
+	pthread_mutex_unlock(&semaphore->mutex);
+
+	return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore){
+	BaseType_t result = pdTRUE;
+
+	pthread_mutex_lock(&semaphore->mutex);
+
+	if(semaphore->isMutex){
+		// FreeRTOS mutexes can only be given back by the task holding them
+		assert(semaphore->holder == xTaskGetCurrentTaskHandle());
+		semaphore->holder = nullptr;
+	}
+
+	if(semaphore->count == 0){
+		semaphore->count = 1;
+		pthread_cond_broadcast(&semaphore->changed);
+	}else{
+		result = pdFALSE;
+	}
+
+	pthread_mutex_unlock(&semaphore->mutex);
+
+	return result;
+}
+
+inline TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t semaphore){
+	pthread_mutex_lock(&semaphore->mutex);
+	TaskHandle_t holder = semaphore->holder;
+	pthread_mutex_unlock(&semaphore->mutex);
+
+	return holder;
+}
+
+#endif
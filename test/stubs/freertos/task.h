@@ -0,0 +1,61 @@
+#ifndef ANARCH_TEST_TASK_H
+#define ANARCH_TEST_TASK_H
+
+#include "FreeRTOS.h"
+
+struct TaskControl{
+	pthread_t thread;
+	void (*function)(void*);
+	void* arg;
+};
+
+typedef TaskControl* TaskHandle_t;
+
+inline TaskHandle_t& _currentTask(){
+	static thread_local TaskHandle_t current = nullptr;
+	return current;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle(){
+	TaskHandle_t& current = _currentTask();
+
+	if(!current){
+		// a thread that wasn't created as a task, e.g. the one running main()
+		current = new TaskControl{ pthread_self(), nullptr, nullptr };
+	}
+
+	return current;
+}
+
+inline void* _taskStart(void* arg){
+	TaskControl* task = (TaskControl*) arg;
+
+	_currentTask() = task;
+	task->function(task->arg);
+
+	return nullptr;
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(void (*function)(void*), const char* name, uint32_t stackDepth, void* arg,
+										  uint32_t priority, TaskHandle_t* handle, BaseType_t core){
+	TaskControl* task = new TaskControl{ pthread_t(), function, arg };
+
+	if(pthread_create(&task->thread, nullptr, _taskStart, task) != 0){
+		delete task;
+		return pdFALSE;
+	}
+
+	if(handle){
+		*handle = task;
+	}
+
+	return pdPASS;
+}
+
+inline void vTaskDelete(TaskHandle_t task){
+	pthread_cancel(task->thread);
+	pthread_join(task->thread, nullptr);
+	delete task;
+}
+
+#endif